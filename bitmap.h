@@ -25,16 +25,24 @@ bitmap_replicated_deinit(bitmap * self)
     mw_free(self->words);
 }
 
-// Set all bits to zero
 static inline void
-bitmap_clear(bitmap * self)
+bitmap_clear_worker(long begin, long end, va_list args)
 {
-    // TODO parallelize with emu_local_for
-    for (long i = 0; i < self->num_words; ++i) {
+    bitmap * self = va_arg(args, bitmap*);
+    for (long i = begin; i < end; ++i) {
         self->words[i] = 0;
     }
 }
 
+// Set all bits to zero
+static inline void
+bitmap_clear(bitmap * self)
+{
+    emu_local_for(0, self->num_words, LOCAL_GRAIN_MIN(self->num_words, 256),
+        bitmap_clear_worker, self
+    );
+}
+
 // Set all bits to zero in all replicated copies
 static inline void
 bitmap_replicated_clear(bitmap * self)
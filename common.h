@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 #include <emu_c_utils/emu_c_utils.h>
 #include <cilk/cilk.h>
 
@@ -13,6 +16,18 @@
 #define cilk_spawn_at(X) cilk_spawn
 #endif
 
+// Type used to store vertex ID's in edge blocks and queues
+// Build with PAPERWASP_VID32 to store them in 32 bits, which halves the memory
+// and bandwidth used by the edge storage. Only works for graphs with fewer than
+// 2^31 vertices. Striped per-vertex arrays and the edge list still use long.
+#ifdef PAPERWASP_VID32
+typedef int32_t vertex_id_t;
+#define VERTEX_ID_MAX INT32_MAX
+#else
+typedef long vertex_id_t;
+#define VERTEX_ID_MAX LONG_MAX
+#endif
+
 // Logging macro. Flush right away since Emu hardware usually doesn't
 #define LOG(...) fprintf(stdout, __VA_ARGS__); fflush(stdout);
 
@@ -53,3 +68,48 @@ get_nth(void * repladdr, long n)
     );
 }
 #endif
+
+// TODO add these to emu_c_utils
+#ifndef __le64__
+static inline FILE *
+mw_fopen(const char *path, const char *mode, void *local_ptr)
+{
+    (void)local_ptr;
+    return fopen(path, mode);
+}
+static inline int
+mw_fclose(FILE * fp)
+{
+    return fclose(fp);
+}
+static inline size_t
+mw_fread(void *ptr, size_t size, size_t nmemb, FILE *fp)
+{
+    return fread(ptr, size, nmemb, fp);
+}
+static inline size_t
+mw_fwrite(void *ptr, size_t size, size_t nmemb, FILE *fp)
+{
+    return fwrite(ptr, size, nmemb, fp);
+}
+
+#else
+#include <memoryweb/io.h>
+#endif
+
+// Clock rate of each nodelet on the Emu Chick
+#define EMU_CLOCK_RATE 175e6
+
+// Returns a timestamp in milliseconds
+// Used to time individual steps within a hooks region
+static inline double
+timestamp_ms()
+{
+#ifdef __le64__
+    return CLOCK() / (EMU_CLOCK_RATE / 1e3);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+#endif
+}
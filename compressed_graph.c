@@ -0,0 +1,149 @@
+#include "compressed_graph.h"
+#include "graph_from_edge_list.h"
+#include <assert.h>
+
+/**
+ * Overview of compress_graph()
+ *   spawn compute_compressed_size_worker() over all vertices
+ *     compute the number of bytes needed to encode the edges of each vertex
+ *     add to the total for the local nodelet
+ *   allocate a chunk of storage on each nodelet
+ *   spawn compress_edges_worker() over all vertices
+ *     carve out space from the local chunk and encode the edges
+ *   free the raw edge storage
+ */
+
+// Number of bytes needed to encode a gap as a varint
+static inline long
+varint_size(long gap)
+{
+    long size = 1;
+    while (gap >= 0x80) {
+        gap >>= 7;
+        size += 1;
+    }
+    return size;
+}
+
+static inline uint8_t *
+varint_encode(uint8_t * p, long gap)
+{
+    while (gap >= 0x80) {
+        *p++ = (uint8_t)(gap & 0x7F) | 0x80;
+        gap >>= 7;
+    }
+    *p++ = (uint8_t)gap;
+    return p;
+}
+
+static void
+compute_compressed_size_worker(long * array, long begin, long end, va_list args)
+{
+    long * sizes = array;
+    long * num_unsorted = va_arg(args, long*);
+    long local_num_unsorted = 0;
+    for (long v = begin; v < end; v += NODELETS()) {
+        vertex_id_t * edges_begin = G.vertex_out_neighbors[v].local_edges;
+        vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[v];
+        long size = 0;
+        long prev = 0;
+        for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
+            if (*e < prev) {
+                local_num_unsorted += 1;
+                break;
+            }
+            size += varint_size(*e - prev);
+            prev = *e;
+        }
+        sizes[v] = size;
+        // Keep track of the number of bytes on each nodelet
+        REMOTE_ADD(&G.num_local_compressed_bytes, size);
+    }
+    if (local_num_unsorted) { REMOTE_ADD(num_unsorted, local_num_unsorted); }
+}
+
+static inline uint8_t *
+grab_bytes(uint8_t * volatile * ptr, long num_bytes)
+{
+    // Atomic add only works on long integers, we need to use it on a pointer
+    return (uint8_t*)ATOMIC_ADDMS((volatile long *)ptr, num_bytes);
+}
+
+static void
+compress_edges_worker(long * array, long begin, long end, va_list args)
+{
+    long * sizes = array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        vertex_id_t * edges_begin = G.vertex_out_neighbors[v].local_edges;
+        vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[v];
+        uint8_t * compressed_edges = grab_bytes(&G.next_compressed_storage, sizes[v]);
+        uint8_t * p = compressed_edges;
+        long prev = 0;
+        for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
+            p = varint_encode(p, *e - prev);
+            prev = *e;
+        }
+        assert(p - compressed_edges == sizes[v]);
+        G.vertex_out_neighbors[v].compressed_edges = compressed_edges;
+    }
+}
+
+void
+compress_graph()
+{
+    assert(!G.is_compressed);
+    if (count_num_heavy_vertices() > 0) {
+        LOG("Graph compression does not support heavy vertices\n");
+        exit(1);
+    }
+    hooks_region_begin("compress_graph");
+    // Segment offsets are not used with compressed edges
+    free_segment_storage();
+
+    // Compute the compressed size of each edge block
+    long * sizes;
+    init_striped_array(&sizes, G.num_vertices);
+    mw_replicated_init(&G.num_local_compressed_bytes, 0);
+    long num_unsorted = 0;
+    emu_1d_array_apply(sizes, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        compute_compressed_size_worker, &num_unsorted
+    );
+    if (num_unsorted > 0) {
+        LOG("Edge blocks must be sorted before compression\n");
+        exit(1);
+    }
+
+    // Allocate a chunk on each nodelet, sized to fit the local compressed edges
+    long total_bytes = 0;
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        long * num_local_bytes = mw_get_nth(&G.num_local_compressed_bytes, nlet);
+        total_bytes += *num_local_bytes;
+        uint8_t * storage = mw_localmalloc(*num_local_bytes + 1, num_local_bytes);
+        if (storage == NULL) {
+            LOG("Failed to allocate compressed edge storage on nodelet %li\n", nlet);
+            exit(1);
+        }
+        *(uint8_t**)mw_get_nth(&G.compressed_storage, nlet) = storage;
+        *(uint8_t**)mw_get_nth(&G.next_compressed_storage, nlet) = storage;
+    }
+
+    // Encode the edges, replacing the pointer to each edge block
+    emu_1d_array_apply(sizes, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        compress_edges_worker
+    );
+    mw_free(sizes);
+
+    // Edges are only stored in compressed form from now on
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        vertex_id_t ** edge_storage = mw_get_nth(&G.edge_storage, nlet);
+        mw_localfree(*edge_storage);
+        *edge_storage = NULL;
+    }
+    mw_replicated_init(&G.is_compressed, 1);
+    hooks_region_end();
+
+    long raw_bytes = 2 * G.num_edges * sizeof(vertex_id_t);
+    LOG("Compressed edges from %li bytes to %li bytes (%3.2fx smaller)\n",
+        raw_bytes, total_bytes,
+        total_bytes ? (double)raw_bytes / total_bytes : 0.0);
+}
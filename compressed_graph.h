@@ -0,0 +1,46 @@
+#pragma once
+
+#include "graph.h"
+
+/**
+ * Compressed edge storage
+ * After compress_graph(), the edges of each vertex are stored as the gaps
+ * between consecutive neighbors in sorted order, each written as a varint:
+ * 7 bits per byte, least significant group first, with the high bit set on
+ * every byte except the last. Most gaps fit in one or two bytes, instead of
+ * sizeof(vertex_id_t). Edges can only be decoded in order, starting from the
+ * first neighbor of the vertex with prev = 0.
+ *
+ * Compression requires sorted edge blocks and no heavy vertices.
+ */
+
+// Decode the next neighbor, advancing p past it
+static inline long
+compressed_next(const uint8_t ** p, long prev)
+{
+    const uint8_t * s = *p;
+    long gap = 0;
+    long shift = 0;
+    uint8_t byte;
+    do {
+        byte = *s++;
+        gap |= (long)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    *p = s;
+    return prev + gap;
+}
+
+// Skip over the next n neighbors, updating p and prev to continue decoding from there
+static inline void
+compressed_skip(const uint8_t ** p, long * prev, long n)
+{
+    long v = *prev;
+    for (long i = 0; i < n; ++i) {
+        v = compressed_next(p, v);
+    }
+    *prev = v;
+}
+
+// Replace the edge blocks of the graph with compressed edges
+void compress_graph();
@@ -1,26 +1,58 @@
 #include "graph.h"
+#include "compressed_graph.h"
 
 typedef struct cursor
 {
     // Pointer to current edge
-    long * e;
+    vertex_id_t * e;
     // Pointer to last edge in block
-    long * end;
+    vertex_id_t * end;
     // Pointer to current edge block (ignored for light vertex)
     edge_block * eb;
     // Index of current nodelet (ignored for light vertex)
     long nlet;
+    // Position of the next encoded edge (compressed graphs only)
+    const uint8_t * p;
+    // Number of edges left, including the current one (compressed graphs only)
+    long remaining;
+    // Current neighbor (compressed graphs only)
+    long dst;
 } cursor;
 
+// Move to the first non-empty edge block of a heavy vertex, starting at c->nlet
+// A heavy vertex may have no edges on some nodelets
+static inline void
+cursor_skip_empty_blocks(cursor * c)
+{
+    for (; c->nlet < NODELETS(); ++c->nlet) {
+        edge_block * eb = mw_get_nth(c->eb, c->nlet);
+        if (eb->num_edges > 0) {
+            c->e = eb->edges;
+            c->end = c->e + eb->num_edges;
+            return;
+        }
+    }
+    c->e = NULL;
+}
+
 static inline void
 cursor_init_out(cursor * c, long src)
 {
-    if (is_heavy_out(src)) {
+    c->p = NULL;
+    if (G.is_compressed) {
+        c->nlet = 0;
+        c->eb = NULL;
+        c->e = NULL;
+        c->end = NULL;
+        c->p = G.vertex_out_neighbors[src].compressed_edges;
+        c->remaining = G.vertex_out_degree[src];
+        c->dst = c->remaining > 0 ? compressed_next(&c->p, 0) : -1;
+    } else if (is_heavy_out(src)) {
         c->nlet = 0;
         c->eb = mw_get_nth(G.vertex_out_neighbors[src].repl_edge_block, 0);
-        c->e = c->eb->edges;
-        c->end = c->e + c->eb->num_edges;
+        cursor_skip_empty_blocks(c);
     } else {
+        c->nlet = 0;
         c->eb = NULL;
         c->e = G.vertex_out_neighbors[src].local_edges;
         c->end = c->e + G.vertex_out_degree[src];
@@ -30,13 +62,29 @@ cursor_init_out(cursor * c, long src)
 static inline bool
 cursor_valid(cursor * c)
 {
+    if (c->p) { return c->remaining > 0; }
     return c->e && c->e < c->end;
 }
 
+// Returns the neighbor at the current position
+static inline long
+cursor_get(cursor * c)
+{
+    return c->p ? c->dst : *c->e;
+}
+
 // Move to next edge
 static inline void
 cursor_next(cursor * c)
 {
+    if (c->p) {
+        // Decode the next edge of a compressed graph
+        c->remaining--;
+        if (c->remaining > 0) {
+            c->dst = compressed_next(&c->p, c->dst);
+        }
+        return;
+    }
     if (!c->e) { return; }
     // Move to the next edge
     c->e++;
@@ -48,13 +96,7 @@ cursor_next(cursor * c)
             // If this was a heavy vertex, move to the next edge block
         } else {
             c->nlet++;
-            if (c->nlet >= NODELETS()) {
-                c->e = NULL;
-                return;
-            }
-            edge_block * eb = mw_get_nth(c->eb, c->nlet);
-            c->e = eb->edges;
-            c->end = c->e + eb->num_edges;
+            cursor_skip_empty_blocks(c);
         }
     }
 }
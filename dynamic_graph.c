@@ -0,0 +1,354 @@
+#include "dynamic_graph.h"
+#include "graph_from_edge_list.h"
+#include <assert.h>
+#include <string.h>
+
+/**
+ * Dynamic graph updates
+ * Applies batches of edge insertions and deletions to the constructed graph,
+ * so queries can run against the updated graph without rebuilding it.
+ * Each batch works like graph construction: count the new edges for each
+ * vertex with remote atomics, make room, then fill in parallel. Since each
+ * edge block is grown to fit the whole batch before any edges are written,
+ * blocks never overflow mid-batch and the kernels keep reading a single
+ * contiguous array of edges for each vertex.
+ *
+ * Overview of dynamic_graph_insert_edges()
+ *   spawn count_pending_edges_worker() over the batch
+ *     increment pending count of both endpoints with remote atomics
+ *   spawn grow_edge_blocks_worker() over all vertices
+ *     IF EDGE BLOCK IS TOO SMALL
+ *       allocate a local block with room to grow, copy edges over
+ *   spawn insert_edges_worker() over the batch
+ *     atomically claim a slot in the edge block of each endpoint
+ *
+ * Overview of dynamic_graph_delete_edges()
+ *   spawn count_pending_edges_worker() over the batch
+ *   spawn allocate_delete_lists_worker() over all vertices
+ *   spawn fill_delete_lists_worker() over the batch
+ *     atomically claim a slot in the delete list of each endpoint
+ *   spawn apply_delete_lists_worker() over all vertices
+ *     sort the delete list and count copies of each neighbor
+ *     binary search for each edge, dropping it if a copy is left to delete
+ */
+
+// Global replicated struct with dynamic graph data pointers
+replicated dynamic_graph_data DYNAMIC_GRAPH;
+
+// Edge blocks grow to at least this many edges
+#define DYNAMIC_GRAPH_MIN_CAPACITY 4
+
+static void
+init_capacity_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    long * num_heavy = va_arg(args, long*);
+    for (long v = begin; v < end; v += NODELETS()) {
+        if (is_heavy_out(v)) { REMOTE_ADD(num_heavy, 1); }
+        // Edge blocks in the constructed graph are packed, with no room to grow
+        DYNAMIC_GRAPH.capacity[v] = G.vertex_out_degree[v];
+        DYNAMIC_GRAPH.pending[v] = 0;
+        DYNAMIC_GRAPH.delete_lists[v] = NULL;
+    }
+}
+
+void
+dynamic_graph_init()
+{
+    init_striped_array(&DYNAMIC_GRAPH.capacity, G.num_vertices);
+    init_striped_array(&DYNAMIC_GRAPH.pending, G.num_vertices);
+    init_striped_array((long**)&DYNAMIC_GRAPH.delete_lists, G.num_vertices);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        vertex_id_t * edge_storage = *(vertex_id_t**)mw_get_nth(&G.edge_storage, nlet);
+        long num_local_edges = *(long*)mw_get_nth(&G.num_local_edges, nlet);
+        *(vertex_id_t**)mw_get_nth(&DYNAMIC_GRAPH.edge_storage_end, nlet) = edge_storage + num_local_edges;
+    }
+
+    long num_heavy = 0;
+    emu_1d_array_apply(DYNAMIC_GRAPH.capacity, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        init_capacity_worker, &num_heavy
+    );
+    if (num_heavy > 0) {
+        LOG("Dynamic graph updates do not support heavy vertices\n");
+        exit(1);
+    }
+}
+
+// Was this edge block carved out of the local edge storage chunk?
+// Must be called from the nodelet that holds the block
+static inline bool
+is_in_edge_storage(vertex_id_t * edges)
+{
+    return edges >= G.edge_storage && edges <= DYNAMIC_GRAPH.edge_storage_end;
+}
+
+static void
+free_grown_edge_blocks_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        vertex_id_t * edges = G.vertex_out_neighbors[v].local_edges;
+        if (DYNAMIC_GRAPH.capacity[v] > 0 && !is_in_edge_storage(edges)) {
+            mw_localfree(edges);
+        }
+    }
+}
+
+void
+dynamic_graph_deinit()
+{
+    emu_1d_array_apply(DYNAMIC_GRAPH.capacity, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        free_grown_edge_blocks_worker
+    );
+    mw_free(DYNAMIC_GRAPH.capacity);
+    mw_free(DYNAMIC_GRAPH.pending);
+    mw_free(DYNAMIC_GRAPH.delete_lists);
+}
+
+static inline bool
+is_valid_edge(long src, long dst)
+{
+    return src >= 0 && src < G.num_vertices && dst >= 0 && dst < G.num_vertices;
+}
+
+static void
+clear_pending_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        DYNAMIC_GRAPH.pending[v] = 0;
+    }
+}
+
+static void
+count_pending_edges_worker(long * array, long begin, long end, va_list args)
+{
+    long * src = array;
+    long * dst = va_arg(args, long*);
+    long * num_invalid = va_arg(args, long*);
+    long local_num_invalid = 0;
+    for (long i = begin; i < end; i += NODELETS()) {
+        long u = src[i];
+        long v = dst[i];
+        if (!is_valid_edge(u, v)) {
+            local_num_invalid += 1;
+            continue;
+        }
+        REMOTE_ADD(&DYNAMIC_GRAPH.pending[u], 1);
+        REMOTE_ADD(&DYNAMIC_GRAPH.pending[v], 1);
+    }
+    if (local_num_invalid) { REMOTE_ADD(num_invalid, local_num_invalid); }
+}
+
+// Count the number of edges being added to or removed from each vertex
+// Returns the number of edges in the batch that were skipped
+static long
+count_pending_edges(long * src, long * dst, long num_edges)
+{
+    emu_1d_array_apply(DYNAMIC_GRAPH.pending, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        clear_pending_worker
+    );
+    long num_invalid = 0;
+    emu_1d_array_apply(src, num_edges, GLOBAL_GRAIN_MIN(num_edges, 64),
+        count_pending_edges_worker, dst, &num_invalid
+    );
+    if (num_invalid > 0) {
+        LOG("Skipping %li edges with vertex ID's out of range\n", num_invalid);
+    }
+    return num_invalid;
+}
+
+static void
+grow_edge_blocks_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        long pending = DYNAMIC_GRAPH.pending[v];
+        if (pending == 0) { continue; }
+        // Keep track of the number of edges on each nodelet
+        REMOTE_ADD(&G.num_local_edges, pending);
+        long degree = G.vertex_out_degree[v];
+        long capacity = DYNAMIC_GRAPH.capacity[v];
+        if (degree + pending <= capacity) { continue; }
+
+        // Double the size of the block, so a vertex that keeps growing is copied O(log(degree)) times
+        long new_capacity = 2 * (degree + pending);
+        if (new_capacity < DYNAMIC_GRAPH_MIN_CAPACITY) { new_capacity = DYNAMIC_GRAPH_MIN_CAPACITY; }
+        vertex_id_t * new_edges = mw_localmalloc(new_capacity * sizeof(vertex_id_t), &G.vertex_out_degree[v]);
+        if (new_edges == NULL) {
+            LOG("Failed to grow edge block of vertex %li\n", v);
+            exit(1);
+        }
+        vertex_id_t * old_edges = G.vertex_out_neighbors[v].local_edges;
+        if (capacity > 0) {
+            memcpy(new_edges, old_edges, degree * sizeof(vertex_id_t));
+            if (!is_in_edge_storage(old_edges)) { mw_localfree(old_edges); }
+        }
+        G.vertex_out_neighbors[v].local_edges = new_edges;
+        DYNAMIC_GRAPH.capacity[v] = new_capacity;
+    }
+}
+
+static inline void
+append_edge(long src, long dst)
+{
+    // Claim a slot at the end of the edge block, then fill it
+    long pos = ATOMIC_ADDMS(&G.vertex_out_degree[src], 1);
+    assert(pos < DYNAMIC_GRAPH.capacity[src]);
+    G.vertex_out_neighbors[src].local_edges[pos] = dst;
+}
+
+static void
+insert_edges_worker(long * array, long begin, long end, va_list args)
+{
+    long * src = array;
+    long * dst = va_arg(args, long*);
+    for (long i = begin; i < end; i += NODELETS()) {
+        long u = src[i];
+        long v = dst[i];
+        if (!is_valid_edge(u, v)) { continue; }
+        // Insert both ways for undirected graph
+        append_edge(u, v);
+        append_edge(v, u);
+    }
+}
+
+long
+dynamic_graph_insert_edges(long * src, long * dst, long num_edges)
+{
+    hooks_region_begin("dynamic_graph_insert_edges");
+    long num_invalid = count_pending_edges(src, dst, num_edges);
+    // Edge blocks might be moved, throw away offsets that point into them
+    free_segment_storage();
+    emu_1d_array_apply(DYNAMIC_GRAPH.pending, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        grow_edge_blocks_worker
+    );
+    emu_1d_array_apply(src, num_edges, GLOBAL_GRAIN_MIN(num_edges, 64),
+        insert_edges_worker, dst
+    );
+    long num_inserted = num_edges - num_invalid;
+    mw_replicated_init(&G.num_edges, G.num_edges + num_inserted);
+    hooks_region_end();
+    return num_inserted;
+}
+
+static void
+allocate_delete_lists_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        long pending = DYNAMIC_GRAPH.pending[v];
+        if (pending == 0) { continue; }
+        vertex_id_t * list = mw_localmalloc(pending * sizeof(vertex_id_t), &DYNAMIC_GRAPH.pending[v]);
+        assert(list);
+        DYNAMIC_GRAPH.delete_lists[v] = list;
+        // Reset so we can use it to fill the list
+        DYNAMIC_GRAPH.pending[v] = 0;
+    }
+}
+
+static inline void
+append_delete(long src, long dst)
+{
+    long pos = ATOMIC_ADDMS(&DYNAMIC_GRAPH.pending[src], 1);
+    DYNAMIC_GRAPH.delete_lists[src][pos] = dst;
+}
+
+static void
+fill_delete_lists_worker(long * array, long begin, long end, va_list args)
+{
+    long * src = array;
+    long * dst = va_arg(args, long*);
+    for (long i = begin; i < end; i += NODELETS()) {
+        long u = src[i];
+        long v = dst[i];
+        if (!is_valid_edge(u, v)) { continue; }
+        append_delete(u, v);
+        append_delete(v, u);
+    }
+}
+
+// Index of x in the sorted array list[0..n), or -1 if it's not there
+static long
+find_sorted(const vertex_id_t * list, long n, vertex_id_t x)
+{
+    long lo = 0, hi = n;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (list[mid] < x) { lo = mid + 1; } else { hi = mid; }
+    }
+    return (lo < n && list[lo] == x) ? lo : -1;
+}
+
+static void
+apply_delete_lists_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    long * num_deleted = va_arg(args, long*);
+    long local_num_deleted = 0;
+    for (long v = begin; v < end; v += NODELETS()) {
+        vertex_id_t * list = DYNAMIC_GRAPH.delete_lists[v];
+        if (list == NULL) { continue; }
+        long num_requests = DYNAMIC_GRAPH.pending[v];
+        vertex_id_t * edges = G.vertex_out_neighbors[v].local_edges;
+        long degree = G.vertex_out_degree[v];
+        // Sort the list and collapse repeated neighbors into counts,
+        // so each edge can be matched with a binary search
+        sort_edge_block(list, list + num_requests);
+        long * counts = mw_localmalloc(num_requests * sizeof(long), list);
+        assert(counts);
+        long num_unique = 0;
+        for (long i = 0; i < num_requests; ++i) {
+            if (num_unique > 0 && list[num_unique - 1] == list[i]) {
+                counts[num_unique - 1] += 1;
+            } else {
+                list[num_unique] = list[i];
+                counts[num_unique] = 1;
+                num_unique += 1;
+            }
+        }
+        // Drop one copy of each neighbor in the list, keeping the rest in order
+        long pos = 0;
+        for (long j = 0; j < degree; ++j) {
+            long k = find_sorted(list, num_unique, edges[j]);
+            if (k >= 0 && counts[k] > 0) {
+                counts[k] -= 1;
+            } else {
+                edges[pos++] = edges[j];
+            }
+        }
+        long num_found = degree - pos;
+        if (num_found > 0) {
+            G.vertex_out_degree[v] = pos;
+            REMOTE_ADD(&G.num_local_edges, -num_found);
+        }
+        local_num_deleted += num_found;
+        mw_localfree(counts);
+        mw_localfree(list);
+        DYNAMIC_GRAPH.delete_lists[v] = NULL;
+    }
+    if (local_num_deleted) { REMOTE_ADD(num_deleted, local_num_deleted); }
+}
+
+long
+dynamic_graph_delete_edges(long * src, long * dst, long num_edges)
+{
+    hooks_region_begin("dynamic_graph_delete_edges");
+    count_pending_edges(src, dst, num_edges);
+    free_segment_storage();
+    emu_1d_array_apply(DYNAMIC_GRAPH.pending, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        allocate_delete_lists_worker
+    );
+    emu_1d_array_apply(src, num_edges, GLOBAL_GRAIN_MIN(num_edges, 64),
+        fill_delete_lists_worker, dst
+    );
+    long num_deleted = 0;
+    emu_1d_array_apply(DYNAMIC_GRAPH.pending, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        apply_delete_lists_worker, &num_deleted
+    );
+    // Each edge was removed from both endpoints
+    num_deleted /= 2;
+    mw_replicated_init(&G.num_edges, G.num_edges - num_deleted);
+    hooks_region_end();
+    return num_deleted;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "graph.h"
+
+typedef struct dynamic_graph_data {
+    // Number of edges that fit in the edge block of each vertex
+    long * capacity;
+    // Number of edges to insert or delete for each vertex in the current batch
+    long * pending;
+    // For each vertex, pointer to a local array of neighbors to delete in the current batch
+    vertex_id_t ** delete_lists;
+    // End of the local chunk of edge storage that the graph was constructed in
+    // Edge blocks inside the chunk can't be freed individually
+    vertex_id_t * edge_storage_end;
+} dynamic_graph_data;
+
+// Global replicated struct with dynamic graph data pointers
+extern replicated dynamic_graph_data DYNAMIC_GRAPH;
+
+// Prepare the constructed graph for updates. Heavy vertices are not supported
+void dynamic_graph_init();
+
+// Insert a batch of undirected edges into the graph
+// src and dst must be striped arrays (like EL.src and EL.dst)
+// Returns the number of edges inserted. Edges with out-of-range vertex ID's are skipped
+long dynamic_graph_insert_edges(long * src, long * dst, long num_edges);
+
+// Delete a batch of undirected edges from the graph
+// src and dst must be striped arrays (like EL.src and EL.dst)
+// Each entry removes one copy of the edge. Returns the number of edges deleted
+long dynamic_graph_delete_edges(long * src, long * dst, long num_edges);
+
+// Free edge blocks allocated by updates. Must be called before graph_deinit()
+void dynamic_graph_deinit();
@@ -3,9 +3,14 @@
 #include <sstream>
 #include <cstdio>
 #include <algorithm>
+#include <numeric>
+#include <vector>
 #include <cassert>
+#include <cstdint>
+#include <iterator>
 
 #include "pvector.h"
+#include "../text_edge_list.h"
 
 using std::cerr;
 
@@ -18,7 +23,7 @@ die()
 void
 print_help_and_quit()
 {
-    cerr << "Usage: ./graph_challenge_convert <infilename>\n";
+    cerr << "Usage: ./graph_challenge_convert <infilename> [el64|el32]\n";
     die();
 }
 
@@ -58,29 +63,62 @@ protected:
 
 
     // Fill up the array with edges from the input file
+    // Accepts el, SNAP and MatrixMarket text files, see text_edge_list.h
     void read_edges(std::string filename)
     {
-        // Open input file
-        FILE* fp = fopen(filename.c_str(), "r");
-        if (!fp) {
+        // Read the whole file into memory
+        std::ifstream ifs(filename, std::ios::binary);
+        if (!ifs) {
             std::cerr << "Cannot open " << filename << "\n";
             die();
         }
+        std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        text_edge_list_info info = text_edge_list_detect(text.data(), text.size());
+        const char * buf = text.data() + info.data_offset;
+        size_t len = text.size() - info.data_offset;
 
-	// read edges, adding to array
-	char instr[512];
-	while (fgets(instr, 512, fp))
-	{
-	    int64_t read_src, read_dst;
-	    if (sscanf(instr, "%ld %ld", &read_src, &read_dst) == 2) {
-              Edge e = { read_src, read_dst };
-	      edges.push_back(e);
-	      int64_t emax = std::max<int64_t>(read_src, read_dst);
-	      num_vertices = std::max<int64_t>(num_vertices, emax);
-	    }
+        // Split into chunks at line boundaries
+        const size_t chunk_size = 1 << 20;
+        int64_t num_chunks = std::max<int64_t>(1, (len + chunk_size - 1) / chunk_size);
+        std::vector<size_t> offsets(num_chunks + 1);
+        for (int64_t c = 0; c < num_chunks; ++c) {
+            offsets[c] = text_edge_list_chunk_begin(buf, len, c * chunk_size);
         }
-        fclose(fp);
-	num_vertices++;
+        offsets[num_chunks] = len;
+
+        // Count the edges in each chunk
+        std::vector<int64_t> chunk_pos(num_chunks + 1, 0);
+        int64_t max_vertex_id = -1;
+        #pragma omp parallel for reduction(max:max_vertex_id)
+        for (int64_t c = 0; c < num_chunks; ++c) {
+            const char * p = buf + offsets[c];
+            long src, dst;
+            int64_t n = 0;
+            while (text_edge_list_next_edge(&p, buf + offsets[c + 1], &src, &dst)) {
+                if (src < info.index_base || dst < info.index_base) {
+                    std::cerr << "Invalid vertex ID in " << filename << "\n";
+                    die();
+                }
+                max_vertex_id = std::max<int64_t>(max_vertex_id, std::max(src, dst));
+                n += 1;
+            }
+            chunk_pos[c + 1] = n;
+        }
+        std::partial_sum(chunk_pos.begin(), chunk_pos.end(), chunk_pos.begin());
+
+        // Parse the edges into the array
+        edges.resize(chunk_pos[num_chunks]);
+        #pragma omp parallel for
+        for (int64_t c = 0; c < num_chunks; ++c) {
+            const char * p = buf + offsets[c];
+            long src, dst;
+            int64_t pos = chunk_pos[c];
+            while (text_edge_list_next_edge(&p, buf + offsets[c + 1], &src, &dst)) {
+                Edge e = { src - info.index_base, dst - info.index_base };
+                edges[pos++] = e;
+            }
+        }
+        num_vertices = std::max<int64_t>(info.num_vertices, max_vertex_id - info.index_base + 1);
     }
 
 
@@ -156,12 +194,18 @@ protected:
 
 public:
 
+    int64_t
+    get_num_vertices() const
+    {
+        return num_vertices;
+    }
+
     // Construct
     explicit
     graph_challenge_edge_reader(int64_t n)
         : edges(n)
-        , flags{0}
         , num_vertices(0)
+        , flags{0}
     {
     }
 
@@ -186,8 +230,28 @@ public:
         shuffle_edges();
     }
 
+    // Write edges with 32 bits per field, converting a chunk at a time
     void
-    dump(std::string filename)
+    write_el32_edges(FILE* fp)
+    {
+        struct edge32
+        {
+            uint32_t src, dst;
+        };
+        const size_t chunk_size = 1 << 20;
+        std::vector<edge32> buffer(chunk_size);
+        for (size_t begin = 0; begin < edges.size(); begin += chunk_size) {
+            size_t end = std::min(begin + chunk_size, edges.size());
+            for (size_t i = begin; i < end; ++i) {
+                buffer[i - begin].src = static_cast<uint32_t>(edges[i].src);
+                buffer[i - begin].dst = static_cast<uint32_t>(edges[i].dst);
+            }
+            fwrite(buffer.data(), sizeof(edge32), end - begin, fp);
+        }
+    }
+
+    void
+    dump(std::string filename, const std::string& format)
     {
         // Open output file
         FILE* fp = fopen(filename.c_str(), "wb");
@@ -196,11 +260,15 @@ public:
             die();
         }
         // Generate header
-        std::string header = get_header("el64");
+        std::string header = get_header(format);
         // Write header
         fwrite(header.c_str(), sizeof(char), header.size(), fp);
         // Write edges
-        fwrite(edges.begin(), sizeof(Edge), edges.size(), fp);
+        if (format == "el32") {
+            write_el32_edges(fp);
+        } else {
+            fwrite(edges.begin(), sizeof(Edge), edges.size(), fp);
+        }
         // Clean up
         fclose(fp);
     }
@@ -210,10 +278,15 @@ public:
 int
 main(int argc, const char* argv[])
 {
-    if (argc != 2) { print_help_and_quit(); }
+    if (argc != 2 && argc != 3) { print_help_and_quit(); }
 
     std::string filename = argv[1];
-    std::string fileext (".el64");
+    std::string format = argc == 3 ? argv[2] : "el64";
+    if (format != "el64" && format != "el32") {
+        std::cerr << "Unsupported output format " << format << "\n";
+        print_help_and_quit();
+    }
+    std::string fileext = "." + format;
 
     struct edge
     {
@@ -222,7 +295,11 @@ main(int argc, const char* argv[])
     graph_challenge_edge_reader<edge> pg(0);
     std::cerr << "Generating from file " << argv[1] << "...\n";
     pg.generate_and_preprocess(filename);
+    if (format == "el32" && pg.get_num_vertices() > (INT64_C(1) << 32)) {
+        std::cerr << "Too many vertices for el32 format\n";
+        die();
+    }
     std::cerr << "Writing to file...\n";
-    pg.dump(filename + fileext);
+    pg.dump(filename + fileext, format);
     std::cerr << "...Done\n";
 }
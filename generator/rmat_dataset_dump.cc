@@ -3,7 +3,10 @@
 #include <sstream>
 #include <cstdio>
 #include <algorithm>
+#include <numeric>
+#include <vector>
 #include <cassert>
+#include <cstdint>
 
 #include "pvector.h"
 #include "rmat_args.h"
@@ -20,7 +23,7 @@ die()
 void
 print_help_and_quit()
 {
-    cerr << "Usage: ./rmat_dataset_dump <rmat_args>\n";
+    cerr << "Usage: ./rmat_dataset_dump <rmat_args> [el64|el32]\n";
     die();
 }
 
@@ -214,8 +217,28 @@ public:
         shuffle_edges();
     }
 
+    // Write edges with 32 bits per field, converting a chunk at a time
     void
-    dump(std::string filename)
+    write_el32_edges(FILE* fp)
+    {
+        struct edge32
+        {
+            uint32_t src, dst;
+        };
+        const size_t chunk_size = 1 << 20;
+        std::vector<edge32> buffer(chunk_size);
+        for (size_t begin = 0; begin < edges.size(); begin += chunk_size) {
+            size_t end = std::min(begin + chunk_size, edges.size());
+            for (size_t i = begin; i < end; ++i) {
+                buffer[i - begin].src = static_cast<uint32_t>(edges[i].src);
+                buffer[i - begin].dst = static_cast<uint32_t>(edges[i].dst);
+            }
+            fwrite(buffer.data(), sizeof(edge32), end - begin, fp);
+        }
+    }
+
+    void
+    dump(std::string filename, const std::string& format)
     {
         // Open output file
         FILE* fp = fopen(filename.c_str(), "wb");
@@ -224,11 +247,15 @@ public:
             die();
         }
         // Generate header
-        std::string header = get_header("el64");
+        std::string header = get_header(format);
         // Write header
         fwrite(header.c_str(), sizeof(char), header.size(), fp);
         // Write edges
-        fwrite(edges.begin(), sizeof(Edge), edges.size(), fp);
+        if (format == "el32") {
+            write_el32_edges(fp);
+        } else {
+            fwrite(edges.begin(), sizeof(Edge), edges.size(), fp);
+        }
         // Clean up
         fclose(fp);
     }
@@ -238,9 +265,14 @@ public:
 int
 main(int argc, const char* argv[])
 {
-    if (argc != 2) { print_help_and_quit(); }
+    if (argc != 2 && argc != 3) { print_help_and_quit(); }
 
     std::string filename = argv[1];
+    std::string format = argc == 3 ? argv[2] : "el64";
+    if (format != "el64" && format != "el32") {
+        std::cerr << "Unsupported output format " << format << "\n";
+        print_help_and_quit();
+    }
 
     // Parse rmat arguments
     rmat_args args = rmat_args::from_string(argv[1]);
@@ -250,6 +282,10 @@ main(int argc, const char* argv[])
         std::cerr << error << "\n";
         print_help_and_quit();
     }
+    if (format == "el32" && args.num_vertices > (INT64_C(1) << 32)) {
+        std::cerr << "Too many vertices for el32 format\n";
+        die();
+    }
 
     struct edge
     {
@@ -259,6 +295,6 @@ main(int argc, const char* argv[])
     std::cerr << "Generating list of " << args.num_edges << " edges...\n";
     pg.generate_and_preprocess();
     std::cerr << "Writing to file...\n";
-    pg.dump(filename);
+    pg.dump(filename, format);
     std::cerr << "...Done\n";
 }
\ No newline at end of file
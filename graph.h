@@ -2,24 +2,28 @@
 
 #include <emu_c_utils/emu_c_utils.h>
 #include "common.h"
+#include "bitmap.h"
 
 typedef struct edge_block {
     long num_edges;
-    long * edges;
+    vertex_id_t * edges;
 } edge_block;
 
 typedef union neighbors
 {
     // Pointer to a local array of edges
     // Array size stored in vertex_out_degree[v]
-    long * local_edges;
+    vertex_id_t * local_edges;
     // View-0 pointer to an edge block on each nodelet
     edge_block * repl_edge_block;
+    // Pointer to local array of delta-encoded edges (compressed graphs only)
+    uint8_t * compressed_edges;
 } neighbors;
 
 // Global data structures
 typedef struct graph {
     // Total number of edges in the graph
+    // Each edge is stored in both directions, or only once if is_oriented is set
     long num_edges;
     // Total number of vertices in the graph (max vertex ID + 1)
     long num_vertices;
@@ -34,21 +38,55 @@ typedef struct graph {
 
     // Total number of edges stored on each nodelet
     long num_local_edges;
-    // Pointer to stripe of memory where edges are stored
-    long * edge_storage;
+    // Pointer to local chunk of memory where edges are stored
+    // Each nodelet's chunk holds exactly num_local_edges edges
+    vertex_id_t * edge_storage;
     // Pointer to un-reserved edge storage in local stripe
-    long * next_edge_storage;
+    vertex_id_t * next_edge_storage;
+
+    // Segment offsets for light vertices whose edges are grouped by nodelet
+    // (see sort_edge_blocks_by_nodelet()). Edges of v that point to nodelet n are
+    // local_edges[segments[n]] through local_edges[segments[n+1] - 1]
+    // NULL if the vertex has no segment offsets
+    long ** vertex_out_segments;
+    // Pointer to local chunk of memory where segment offsets are stored
+    long * segment_storage;
+
+    // Nonzero if the edges of each vertex are stored in compressed form
+    // (see compressed_graph.h). The raw edge storage is freed after compression
+    long is_compressed;
+    // Size of the compressed edges stored on each nodelet
+    long num_local_compressed_bytes;
+    // Pointer to local chunk of memory where compressed edges are stored
+    uint8_t * compressed_storage;
+    // Pointer to un-reserved compressed edge storage in local stripe
+    uint8_t * next_compressed_storage;
+
+    // Nonzero if each undirected edge is stored only once, as u->v where v
+    // has lower (degree, id) rank than u (see tc_orient_by_degree())
+    long is_oriented;
 
     long heavy_threshold;
+    // Bit v is set if vertex v is heavy (degree >= heavy_threshold)
+    // Replicated, so every nodelet can check locally
+    bitmap heavy_out;
 } graph;
 
 // Single global instance of the graph
 extern replicated graph G;
 
+// Heavy vertices have an edge block on each nodelet, holding the edges that
+// point to vertices on that nodelet. Light vertices have a local array of edges.
 static inline bool
 is_heavy_out(long vertex_id)
 {
-    return false;
-//    // TODO it would be great if this were a local query, maybe a replicated bitmap?
-//    return G.vertex_out_degree[vertex_id] >= G.heavy_threshold;
+    // Local lookup in the replicated bitmap, no need to migrate to the vertex
+    return bitmap_get_bit(&G.heavy_out, vertex_id);
+}
+
+// Returns the segment offsets of v, or NULL if its edges have not been grouped by nodelet
+static inline long *
+get_out_segments(long vertex_id)
+{
+    return G.vertex_out_segments ? G.vertex_out_segments[vertex_id] : NULL;
 }
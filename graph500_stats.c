@@ -0,0 +1,143 @@
+#include "graph500_stats.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include "common.h"
+
+static int
+compare_doubles(const void * a, const void * b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Value at fractional position t (counting from 1) in a sorted array,
+// interpolating linearly between neighbors
+static double
+interpolate(const double * sorted, long n, double t)
+{
+    if (t <= 1) { return sorted[0]; }
+    if (t >= n) { return sorted[n-1]; }
+    long lo = (long)floor(t);
+    double frac = t - lo;
+    return (1 - frac) * sorted[lo-1] + frac * sorted[lo];
+}
+
+static void
+compute_sample_stats(sample_stats * out, const double * data, long n)
+{
+    assert(n > 0);
+    double * sorted = malloc(n * sizeof(double));
+    assert(sorted);
+    for (long i = 0; i < n; ++i) { sorted[i] = data[i]; }
+    qsort(sorted, n, sizeof(double), compare_doubles);
+
+    out->min = sorted[0];
+    out->first_quartile = interpolate(sorted, n, (n + 1) / 4.0);
+    out->median = interpolate(sorted, n, (n + 1) / 2.0);
+    out->third_quartile = interpolate(sorted, n, 3 * (n + 1) / 4.0);
+    out->max = sorted[n-1];
+
+    double sum = 0;
+    for (long i = 0; i < n; ++i) { sum += data[i]; }
+    out->mean = sum / n;
+    // Sample standard deviation
+    double sum_sq = 0;
+    for (long i = 0; i < n; ++i) {
+        double d = data[i] - out->mean;
+        sum_sq += d * d;
+    }
+    out->stddev = n > 1 ? sqrt(sum_sq / (n - 1)) : 0;
+
+    free(sorted);
+}
+
+/**
+ * Compute the Graph500 statistics block from the samples of each trial
+ * @param stats Output
+ * @param time_ms Time of each search in milliseconds
+ * @param nedge Number of edges traversed by each search
+ * @param num_trials Number of samples in each array
+ */
+void
+graph500_stats_compute(graph500_stats * stats, const double * time_ms, const long * nedge, long num_trials)
+{
+    long n = num_trials;
+    assert(n > 0);
+    stats->num_trials = n;
+    double * time_s = malloc(n * sizeof(double));
+    double * nedge_d = malloc(n * sizeof(double));
+    double * teps = malloc(n * sizeof(double));
+    assert(time_s && nedge_d && teps);
+    for (long i = 0; i < n; ++i) {
+        time_s[i] = time_ms[i] / 1000;
+        nedge_d[i] = nedge[i];
+        teps[i] = nedge[i] / time_s[i];
+    }
+    compute_sample_stats(&stats->time, time_s, n);
+    compute_sample_stats(&stats->nedge, nedge_d, n);
+    compute_sample_stats(&stats->teps, teps, n);
+
+    // TEPS is a rate, so the mean is the harmonic mean.
+    // The standard deviation is computed from the reciprocals, as in the reference code
+    sample_stats inverse;
+    for (long i = 0; i < n; ++i) { teps[i] = 1 / teps[i]; }
+    compute_sample_stats(&inverse, teps, n);
+    stats->harmonic_mean_teps = 1 / inverse.mean;
+    stats->harmonic_stddev_teps = n > 1
+        ? inverse.stddev / (inverse.mean * inverse.mean * sqrt(n - 1))
+        : 0;
+
+    free(time_s);
+    free(nedge_d);
+    free(teps);
+}
+
+static void
+print_sample_stats(const char * name, const sample_stats * s, bool is_rate)
+{
+    LOG("min_%s: %20.17e\n", name, s->min);
+    LOG("firstquartile_%s: %20.17e\n", name, s->first_quartile);
+    LOG("median_%s: %20.17e\n", name, s->median);
+    LOG("thirdquartile_%s: %20.17e\n", name, s->third_quartile);
+    LOG("max_%s: %20.17e\n", name, s->max);
+    if (!is_rate) {
+        LOG("mean_%s: %20.17e\n", name, s->mean);
+        LOG("stddev_%s: %20.17e\n", name, s->stddev);
+    }
+}
+
+// Print the statistics in the same format as the Graph500 reference code
+void
+graph500_stats_print(const graph500_stats * stats)
+{
+    LOG("NBFS: %li\n", stats->num_trials);
+    print_sample_stats("time", &stats->time, false);
+    print_sample_stats("nedge", &stats->nedge, false);
+    print_sample_stats("TEPS", &stats->teps, true);
+    LOG("harmonic_mean_TEPS: %20.17e\n", stats->harmonic_mean_teps);
+    LOG("harmonic_stddev_TEPS: %20.17e\n", stats->harmonic_stddev_teps);
+}
+
+static void
+write_sample_stats_json(FILE * fp, const char * name, const sample_stats * s)
+{
+    fprintf(fp, "  \"%s\": {\"min\": %.17g, \"firstquartile\": %.17g, \"median\": %.17g, "
+        "\"thirdquartile\": %.17g, \"max\": %.17g, \"mean\": %.17g, \"stddev\": %.17g},\n",
+        name, s->min, s->first_quartile, s->median, s->third_quartile, s->max, s->mean, s->stddev);
+}
+
+// Write the statistics as a single JSON object
+void
+graph500_stats_write_json(FILE * fp, const graph500_stats * stats)
+{
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"NBFS\": %li,\n", stats->num_trials);
+    write_sample_stats_json(fp, "time", &stats->time);
+    write_sample_stats_json(fp, "nedge", &stats->nedge);
+    write_sample_stats_json(fp, "TEPS", &stats->teps);
+    fprintf(fp, "  \"harmonic_mean_TEPS\": %.17g,\n", stats->harmonic_mean_teps);
+    fprintf(fp, "  \"harmonic_stddev_TEPS\": %.17g\n", stats->harmonic_stddev_teps);
+    fprintf(fp, "}\n");
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdio.h>
+
+// Summary of a set of samples, as reported by the Graph500 reference code
+typedef struct sample_stats {
+    double min;
+    double first_quartile;
+    double median;
+    double third_quartile;
+    double max;
+    double mean;
+    double stddev;
+} sample_stats;
+
+// Statistics over all BFS trials, as required by the Graph500 specification
+typedef struct graph500_stats {
+    long num_trials;
+    // Time of each search, in seconds
+    sample_stats time;
+    // Number of edges traversed by each search
+    sample_stats nedge;
+    // Traversed edges per second for each search
+    sample_stats teps;
+    double harmonic_mean_teps;
+    double harmonic_stddev_teps;
+} graph500_stats;
+
+void graph500_stats_compute(graph500_stats * stats, const double * time_ms, const long * nedge, long num_trials);
+void graph500_stats_print(const graph500_stats * stats);
+void graph500_stats_write_json(FILE * fp, const graph500_stats * stats);
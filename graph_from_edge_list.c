@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <emu_c_utils/emu_c_utils.h>
 
 #include "graph.h"
@@ -39,6 +40,32 @@ calculate_degrees_worker(long * array, long begin, long end, va_list args)
     }
 }
 
+static void
+mark_heavy_vertices_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        if (G.vertex_out_degree[v] >= G.heavy_threshold) {
+            bitmap_set_bit(&G.heavy_out, v);
+        }
+    }
+}
+
+// Build the replicated bitmap used by is_heavy_out()
+// Vertex degrees and G.heavy_threshold must already be set
+void
+mark_heavy_vertices()
+{
+    bitmap_replicated_init(&G.heavy_out, G.num_vertices);
+    bitmap_replicated_clear(&G.heavy_out);
+    // Each nodelet sets bits in its local copy for its own vertices
+    emu_1d_array_apply(G.vertex_out_degree, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        mark_heavy_vertices_worker
+    );
+    // Combine with all other copies
+    bitmap_replicated_sync(&G.heavy_out);
+}
+
 static inline edge_block *
 get_remote_edge_block(long src, long dst)
 {
@@ -137,11 +164,39 @@ long compute_max_edges_per_nodelet()
     return max_edges_per_nodelet;
 }
 
-static inline long *
-grab_edges(long * volatile * ptr, long num_edges)
+// Allocate storage for G.num_local_edges edges on each nodelet
+// G.edge_storage and G.next_edge_storage will point to the local chunk
+void
+allocate_edge_storage()
 {
-    // Atomic add only works on long integers, we need to use it on a long*
-    return (long*)ATOMIC_ADDMS((volatile long *)ptr, num_edges * sizeof(long));
+    // Run around and compute the largest number of edges on any nodelet
+    long max_edges_per_nodelet = compute_max_edges_per_nodelet();
+    LOG("Will use up to %li MiB on each nodelet, %li MiB in total\n",
+        (max_edges_per_nodelet * sizeof(vertex_id_t)) >> 20,
+        (2 * G.num_edges * sizeof(vertex_id_t)) >> 20);
+
+    // Allocate a separate chunk on each nodelet, sized to fit the local edges
+    // A single mw_malloc2d would reserve room for the nodelet with the most
+    // edges everywhere, wasting a lot of space on skewed graphs
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        long * num_local_edges = mw_get_nth(&G.num_local_edges, nlet);
+        // Always allocate at least one element, even if the nodelet has no edges
+        vertex_id_t * edge_storage = mw_localmalloc(sizeof(vertex_id_t) * (*num_local_edges + 1), num_local_edges);
+        if (edge_storage == NULL) {
+            LOG("Failed to allocate edge storage on nodelet %li\n", nlet);
+            exit(1);
+        }
+        // Initialize each copy of G.edge_storage to point to the local chunk
+        *(vertex_id_t**)mw_get_nth(&G.edge_storage, nlet) = edge_storage;
+        *(vertex_id_t**)mw_get_nth(&G.next_edge_storage, nlet) = edge_storage;
+    }
+}
+
+static inline vertex_id_t *
+grab_edges(vertex_id_t * volatile * ptr, long num_edges)
+{
+    // Atomic add only works on long integers, we need to use it on a pointer
+    return (vertex_id_t*)ATOMIC_ADDMS((volatile long *)ptr, num_edges * sizeof(vertex_id_t));
 }
 
 void
@@ -178,7 +233,7 @@ void
 insert_edge(long src, long dst)
 {
     // Pointer to local edge array for this vertex
-    long * edges;
+    vertex_id_t * edges;
     // Pointer to current size of local edge array for this vertex
     long * num_edges_ptr;
     // Insert the out-edge
@@ -210,20 +265,10 @@ fill_edge_blocks_worker(long * array, long begin, long end, va_list args)
     }
 }
 
-int
-compare_longs(const void * a, const void * b)
-{
-    long lhs = *(long*)a;
-    long rhs = *(long*)b;
-    if (lhs < rhs) { return -1; }
-    if (lhs > rhs) { return  1; }
-    return 0;
-}
-
 void
-sort_edge_block(long * edges_begin, long * edges_end)
+sort_edge_block(vertex_id_t * edges_begin, vertex_id_t * edges_end)
 {
-    qsort(edges_begin, edges_end-edges_begin, sizeof(long), compare_longs);
+    emu_radix_sort_vertex_ids(edges_begin, edges_end);
 }
 
 void
@@ -234,13 +279,13 @@ sort_edge_blocks_worker(long * array, long begin, long end, va_list args)
         if (is_heavy_out(v)) {
             for (long nlet = 0; nlet < NODELETS(); ++nlet) {
                 edge_block * eb = mw_get_nth(G.vertex_out_neighbors[v].repl_edge_block, nlet);
-                long * edges_begin = eb->edges;
-                long * edges_end = edges_begin + eb->num_edges;
+                vertex_id_t * edges_begin = eb->edges;
+                vertex_id_t * edges_end = edges_begin + eb->num_edges;
                 cilk_spawn sort_edge_block(edges_begin, edges_end);
             }
         } else {
-            long * edges_begin = G.vertex_out_neighbors[v].local_edges;
-            long * edges_end = edges_begin + G.vertex_out_degree[v];
+            vertex_id_t * edges_begin = G.vertex_out_neighbors[v].local_edges;
+            vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[v];
             sort_edge_block(edges_begin, edges_end);
         }
     }
@@ -256,68 +301,173 @@ sort_edge_blocks()
     hooks_region_end();
 }
 
-static int
-compare_nodelets(const void * a, const void * b)
-{
-    long lhs = *(long*)a;
-    long rhs = *(long*)b;
-    long nlet_mask = NODELETS() - 1;
+/**
+ * Grouping edges by nodelet
+ * There are only NODELETS() distinct keys, so instead of sorting each edge block
+ * we count the edges pointing to each nodelet and scatter them into place.
+ * Light vertices with at least SEGMENT_MIN_EDGES_PER_NODELET edges per nodelet
+ * keep the resulting segment offsets, so traversal kernels can spawn a thread
+ * for each segment. The threshold keeps the offsets from taking up more than
+ * a fraction of the memory used by the edges.
+ *
+ * Overview of sort_edge_blocks_by_nodelet()
+ *   spawn sort_edge_blocks_by_nodelet_spawner() on each nodelet
+ *     allocate local storage for segment offsets
+ *     spawn sort_edge_blocks_by_nodelet_worker() to grab vertices on this nodelet
+ *       (each worker keeps one local scratch buffer, grown as needed)
+ *       IF HEAVY VERTEX
+ *         Edges are already split by nodelet, sort each edge block by ID if requested
+ *       ELSE IF LIGHT VERTEX
+ *         sort edge block by ID if requested
+ *         IF HAS SEGMENTS
+ *           call bucket_edge_block_by_nodelet() to group edges and record offsets
+ *         ELSE
+ *           stable radix sort on the nodelet bits
+ */
 
-    long lhs_nlet = lhs & nlet_mask;
-    long rhs_nlet = rhs & nlet_mask;
+#define SEGMENT_MIN_EDGES_PER_NODELET 8
 
-    if (lhs_nlet < rhs_nlet) { return -1; }
-    if (lhs_nlet > rhs_nlet) { return  1; }
-    return 0;
+static inline bool
+needs_segments(long v)
+{
+    return !is_heavy_out(v)
+        && G.vertex_out_degree[v] >= SEGMENT_MIN_EDGES_PER_NODELET * NODELETS();
 }
 
+// Stable counting sort of an edge block by nodelet
+// segments must have room for NODELETS() + 1 offsets
+// tmp must have room for all the edges in the block
 static void
-sort_edge_block_by_nodelet(long * edges_begin, long * edges_end)
+bucket_edge_block_by_nodelet(vertex_id_t * edges_begin, vertex_id_t * edges_end, long * segments,
+    vertex_id_t * tmp)
 {
-//    qsort(edges_begin, edges_end-edges_begin, sizeof(long), compare_nodelets);
-    emu_quick_sort_longs(edges_begin, edges_end, compare_nodelets);
-//    assert(is_sorted(edges_begin, edges_end, compare_nodelets));
+    const long nodelets = NODELETS();
+    long degree = edges_end - edges_begin;
+    // Count the edges pointing to each nodelet
+    for (long nlet = 0; nlet <= nodelets; ++nlet) { segments[nlet] = 0; }
+    for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
+        segments[*e % nodelets + 1] += 1;
+    }
+    // Prefix sum to find where each segment begins
+    for (long nlet = 0; nlet < nodelets; ++nlet) {
+        segments[nlet + 1] += segments[nlet];
+    }
+    // Scatter into the temporary buffer, advancing the start of each segment
+    for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
+        tmp[segments[*e % nodelets]++] = *e;
+    }
+    memcpy(edges_begin, tmp, degree * sizeof(vertex_id_t));
+    // Each segment now starts where the previous one used to, shift back into place
+    for (long nlet = nodelets; nlet > 0; --nlet) {
+        segments[nlet] = segments[nlet - 1];
+    }
+    segments[0] = 0;
+}
+
+static void
+sort_edge_block_by_nodelet(vertex_id_t * edges_begin, vertex_id_t * edges_end)
+{
+    // The nodelet of a vertex is given by the low bits of its ID
+    long nlet_bits = 0;
+    while ((1L << nlet_bits) < NODELETS()) { ++nlet_bits; }
+    emu_radix_sort_vertex_ids_low_bits(edges_begin, edges_end, nlet_bits);
 }
 
 static void
-sort_edge_blocks_by_nodelet_worker(long *v_pos)
+sort_edge_blocks_by_nodelet_worker(long * v_pos, long * volatile * next_segments, bool sort_by_id)
 {
+    // Scratch space for bucket_edge_block_by_nodelet(), reused across vertices
+    // Doubled whenever a larger edge block comes along, so it is only reallocated a few times
+    vertex_id_t * tmp = NULL;
+    long tmp_capacity = 0;
     // Dynamic schedule, atomically grab the next vertex on this nodelet
     long v = ATOMIC_ADDMS(v_pos, NODELETS());
     for (; v < G.num_vertices; v = ATOMIC_ADDMS(v_pos, NODELETS())) {
+        G.vertex_out_segments[v] = NULL;
         if (is_heavy_out(v)) {
+            // Each edge block only holds edges pointing to its own nodelet
+            if (!sort_by_id) { continue; }
             for (long nlet = 0; nlet < NODELETS(); ++nlet) {
                 edge_block * eb = mw_get_nth(G.vertex_out_neighbors[v].repl_edge_block, nlet);
-                long * edges_begin = eb->edges;
-                long * edges_end = edges_begin + eb->num_edges;
-                cilk_spawn sort_edge_block_by_nodelet(edges_begin, edges_end);
+                vertex_id_t * edges_begin = eb->edges;
+                vertex_id_t * edges_end = edges_begin + eb->num_edges;
+                cilk_spawn sort_edge_block(edges_begin, edges_end);
             }
         } else {
-            long * edges_begin = G.vertex_out_neighbors[v].local_edges;
-            long * edges_end = edges_begin + G.vertex_out_degree[v];
-            sort_edge_block_by_nodelet(edges_begin, edges_end);
+            vertex_id_t * edges_begin = G.vertex_out_neighbors[v].local_edges;
+            vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[v];
+            // Grouping by nodelet is stable, so edges stay sorted within each segment
+            if (sort_by_id) {
+                sort_edge_block(edges_begin, edges_end);
+            }
+            if (needs_segments(v)) {
+                long * segments = (long*)ATOMIC_ADDMS((volatile long *)next_segments,
+                    (NODELETS() + 1) * sizeof(long));
+                long degree = edges_end - edges_begin;
+                if (degree > tmp_capacity) {
+                    if (tmp) { mw_localfree(tmp); }
+                    tmp_capacity = tmp_capacity * 2 > degree ? tmp_capacity * 2 : degree;
+                    tmp = mw_localmalloc(tmp_capacity * sizeof(vertex_id_t), edges_begin);
+                    assert(tmp);
+                }
+                bucket_edge_block_by_nodelet(edges_begin, edges_end, segments, tmp);
+                G.vertex_out_segments[v] = segments;
+            } else {
+                sort_edge_block_by_nodelet(edges_begin, edges_end);
+            }
         }
     }
+    if (tmp) { mw_localfree(tmp); }
 }
 
 static void
-sort_edge_blocks_by_nodelet_spawner(long nlet)
+sort_edge_blocks_by_nodelet_spawner(long nlet, bool sort_by_id)
 {
+    // Allocate local storage for the segment offsets of local vertices
+    long num_segmented_vertices = 0;
+    for (long v = nlet; v < G.num_vertices; v += NODELETS()) {
+        if (needs_segments(v)) { num_segmented_vertices += 1; }
+    }
+    long * segment_storage = mw_localmalloc(
+        sizeof(long) * (num_segmented_vertices * (NODELETS() + 1) + 1), &G.vertex_out_segments[nlet]);
+    if (segment_storage == NULL) {
+        LOG("Failed to allocate segment storage on nodelet %li\n", nlet);
+        exit(1);
+    }
+    *(long**)mw_get_nth(&G.segment_storage, nlet) = segment_storage;
+    long * next_segments = segment_storage;
+
     // Spawn workers to handle edge blocks for all vertices on this nodelet
     long num_workers = 64;
     long v = nlet;
     for (long t = 0; t < num_workers; ++t) {
-        cilk_spawn sort_edge_blocks_by_nodelet_worker(&v);
+        cilk_spawn sort_edge_blocks_by_nodelet_worker(&v, &next_segments, sort_by_id);
     }
+    cilk_sync;
 }
 
 void
-sort_edge_blocks_by_nodelet()
+free_segment_storage()
 {
+    if (G.vertex_out_segments == NULL) { return; }
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        mw_localfree(*(long**)mw_get_nth(&G.segment_storage, nlet));
+    }
+    mw_free(G.vertex_out_segments);
+    replicated_init_ptr((long**)&G.vertex_out_segments, NULL);
+}
+
+void
+sort_edge_blocks_by_nodelet(bool sort_by_id)
+{
+    // Throw away offsets from a previous call
+    free_segment_storage();
+    init_striped_array((long**)&G.vertex_out_segments, G.num_vertices);
+
     hooks_region_begin("sort_edge_blocks_by_nodelet");
     // Spawn a thread at each nodelet to handle local vertices
     for (long nlet = 0; nlet < NODELETS(); ++nlet) {
-        cilk_spawn_at(&G.vertex_out_neighbors[nlet]) sort_edge_blocks_by_nodelet_spawner(nlet);
+        cilk_spawn_at(&G.vertex_out_neighbors[nlet]) sort_edge_blocks_by_nodelet_spawner(nlet, sort_by_id);
     }
     cilk_sync;
     hooks_region_end();
@@ -327,8 +477,8 @@ bool
 out_edge_exists(long src, long dst)
 {
     // Find the edge block that would contain this neighbor
-    long * edges_begin;
-    long * edges_end;
+    vertex_id_t * edges_begin;
+    vertex_id_t * edges_end;
     if (is_heavy_out(src)) {
         edge_block * eb = mw_get_localto(
             G.vertex_out_neighbors[src].repl_edge_block,
@@ -342,7 +492,7 @@ out_edge_exists(long src, long dst)
     }
 
     // Search for the neighbor
-    for (long * e = edges_begin; e < edges_end; ++e) {
+    for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
         assert(*e >= 0);
         assert(*e < G.num_vertices);
         if (*e == dst) { return true; }
@@ -383,8 +533,8 @@ check_graph() {
 void dump_graph()
 {
     for (long src = 0; src < G.num_vertices; ++src) {
-        long * edges_begin;
-        long * edges_end;
+        vertex_id_t * edges_begin;
+        vertex_id_t * edges_end;
         if (G.vertex_out_degree[src] == 0) {
             continue;
         } else if (is_heavy_out(src)) {
@@ -394,21 +544,33 @@ void dump_graph()
                 edge_block * eb = mw_get_nth(G.vertex_out_neighbors[src].repl_edge_block, nlet);
                 edges_begin = eb->edges;
                 edges_end = edges_begin + eb->num_edges;
-                for (long * e = edges_begin; e < edges_end; ++e) { LOG(" %li", *e); }
+                for (vertex_id_t * e = edges_begin; e < edges_end; ++e) { LOG(" %li", (long)*e); }
             }
         } else {
             LOG("%li ->", src);
             edges_begin = G.vertex_out_neighbors[src].local_edges;
             edges_end = edges_begin + G.vertex_out_degree[src];
-            for (long * e = edges_begin; e < edges_end; ++e) { LOG(" %li", *e); }
+            for (vertex_id_t * e = edges_begin; e < edges_end; ++e) { LOG(" %li", (long)*e); }
         }
         LOG("\n");
     }
 }
 
+// Make sure every vertex ID in the edge list fits in a vertex_id_t
+static void
+check_vertex_id_range()
+{
+    if (EL.num_vertices - 1 > VERTEX_ID_MAX) {
+        LOG("Graph has %li vertices, too many for %li-byte vertex ID's\n",
+            EL.num_vertices, (long)sizeof(vertex_id_t));
+        exit(1);
+    }
+}
+
 void
 construct_graph_from_edge_list(long heavy_threshold)
 {
+    check_vertex_id_range();
     mw_replicated_init(&G.num_edges, EL.num_edges);
     mw_replicated_init(&G.num_vertices, EL.num_vertices);
     mw_replicated_init(&G.heavy_threshold, heavy_threshold);
@@ -437,6 +599,12 @@ construct_graph_from_edge_list(long heavy_threshold)
     );
     hooks_region_end();
 
+    // Decide which vertices are heavy, now that we know their degree
+    LOG("Marking heavy vertices...\n");
+    hooks_region_begin("mark_heavy_vertices");
+    mark_heavy_vertices();
+    hooks_region_end();
+
     // Allocate edge blocks at each vertex
     // Heavy edges get an edge block on each nodelet
     // Edge storage is not allocated yet
@@ -470,20 +638,7 @@ construct_graph_from_edge_list(long heavy_threshold)
     hooks_region_end();
 
     LOG("Allocating edge storage...\n");
-    // Run around and compute the largest number of edges on any nodelet
-    long max_edges_per_nodelet = compute_max_edges_per_nodelet();
-    LOG("Will use %li MiB on each nodelet\n", (max_edges_per_nodelet * sizeof(long)) >> 20);
-
-    // Allocate a big stripe, such that there is enough room for the nodelet
-    // with the most local edges
-    // There will be wasted space on the other nodelets
-    long ** edge_storage = mw_malloc2d(NODELETS(), sizeof(long) * max_edges_per_nodelet);
-    assert(edge_storage);
-    // Initialize each copy of G.edge_storage to point to the local chunk
-    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
-        *(long**)mw_get_nth(&G.edge_storage, nlet) = edge_storage[nlet];
-        *(long**)mw_get_nth(&G.next_edge_storage, nlet) = edge_storage[nlet];
-    }
+    allocate_edge_storage();
 
     // Assign each edge block a position within the big array
     LOG("Carving edge storage...\n");
@@ -510,6 +665,247 @@ construct_graph_from_edge_list(long heavy_threshold)
     LOG("...Done\n");
 }
 
+/**
+ * Sort-based graph construction
+ * An alternative to construct_graph_from_edge_list() that avoids per-edge
+ * remote atomics. Each edge is copied (in both directions) into a bucket on
+ * the home nodelet of its source vertex. Then each nodelet builds its part of
+ * the graph from its own bucket, using only local memory: count degrees,
+ * carve out edge storage, fill, and sort each edge block.
+ *
+ * The edge list is read twice: once to size the buckets, so each one can be
+ * allocated on its own nodelet with exactly the space it needs, and once to
+ * fill them. Threads claim space in each bucket with one atomic per nodelet,
+ * rather than one atomic per edge. The edge blocks come out sorted by vertex ID, so there
+ * is no need to call sort_edge_blocks() afterwards.
+ *
+ * Heavy vertices are not supported, every vertex stores all of its edges on
+ * its home nodelet.
+ */
+
+// Count how many edges will land in each bucket
+void
+count_bucket_sizes_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    long * bucket_sizes = va_arg(args, long*);
+    // One counter per nodelet, allocated next to the edges instead of on the stack
+    long * counts = mw_localmalloc(NODELETS() * sizeof(long), &EL.src[begin]);
+    assert(counts);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) { counts[nlet] = 0; }
+    for (long i = begin; i < end; i += NODELETS()) {
+        counts[EL.src[i] % NODELETS()] += 1;
+        counts[EL.dst[i] % NODELETS()] += 1;
+    }
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        if (counts[nlet]) { REMOTE_ADD(&bucket_sizes[nlet], counts[nlet]); }
+    }
+    mw_localfree(counts);
+}
+
+// Copy each edge into the bucket on the home nodelet of its source vertex
+void
+fill_buckets_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    edge ** buckets = va_arg(args, edge**);
+    long * bucket_pos = va_arg(args, long*);
+    // Count again, so we can claim all the space we need in one atomic
+    long * pos = mw_localmalloc(NODELETS() * sizeof(long), &EL.src[begin]);
+    assert(pos);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) { pos[nlet] = 0; }
+    for (long i = begin; i < end; i += NODELETS()) {
+        pos[EL.src[i] % NODELETS()] += 1;
+        pos[EL.dst[i] % NODELETS()] += 1;
+    }
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        if (pos[nlet]) { pos[nlet] = ATOMIC_ADDMS(&bucket_pos[nlet], pos[nlet]); }
+    }
+    // Write the edges into the buckets, no atomics required
+    for (long i = begin; i < end; i += NODELETS()) {
+        long src = EL.src[i];
+        long dst = EL.dst[i];
+        long src_nlet = src % NODELETS();
+        long dst_nlet = dst % NODELETS();
+        buckets[src_nlet][pos[src_nlet]++] = (edge){src, dst};
+        buckets[dst_nlet][pos[dst_nlet]++] = (edge){dst, src};
+    }
+    mw_localfree(pos);
+}
+
+static void
+count_local_degrees_worker(long begin, long end, va_list args)
+{
+    edge * bucket = va_arg(args, edge*);
+    for (long i = begin; i < end; ++i) {
+        // The source vertex is always local
+        ATOMIC_ADDMS(&G.vertex_out_degree[bucket[i].src], 1);
+    }
+}
+
+static void
+fill_local_edge_blocks_worker(long begin, long end, va_list args)
+{
+    edge * bucket = va_arg(args, edge*);
+    for (long i = begin; i < end; ++i) {
+        insert_edge(bucket[i].src, bucket[i].dst);
+    }
+}
+
+static void
+sort_local_edge_blocks_worker(long begin, long end, va_list args)
+{
+    long nlet = va_arg(args, long);
+    for (long i = begin; i < end; ++i) {
+        long v = nlet + i * NODELETS();
+        vertex_id_t * edges_begin = G.vertex_out_neighbors[v].local_edges;
+        vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[v];
+        sort_edge_block(edges_begin, edges_end);
+    }
+}
+
+// Build the part of the graph that lives on this nodelet from the local bucket
+static void
+build_local_edge_blocks(edge * bucket, long num_edges, long nlet)
+{
+    long num_local_vertices = nlet < G.num_vertices
+        ? (G.num_vertices - nlet + NODELETS() - 1) / NODELETS()
+        : 0;
+    long edge_grain = LOCAL_GRAIN_MIN(num_edges, 256);
+    long vertex_grain = LOCAL_GRAIN_MIN(num_local_vertices, 64);
+
+    // Compute degree of each local vertex
+    emu_local_for(0, num_edges, edge_grain,
+        count_local_degrees_worker, bucket
+    );
+    // Carve out a chunk of edge storage for each local vertex, in order
+    vertex_id_t * next_edges = G.next_edge_storage;
+    for (long i = 0; i < num_local_vertices; ++i) {
+        long v = nlet + i * NODELETS();
+        G.vertex_out_neighbors[v].local_edges = next_edges;
+        next_edges += G.vertex_out_degree[v];
+        // HACK Prepare to fill
+        G.vertex_out_degree[v] = 0;
+    }
+    G.next_edge_storage = next_edges;
+    // Fill and sort each edge block
+    emu_local_for(0, num_edges, edge_grain,
+        fill_local_edge_blocks_worker, bucket
+    );
+    emu_local_for(0, num_local_vertices, vertex_grain,
+        sort_local_edge_blocks_worker, nlet
+    );
+}
+
+void
+construct_graph_from_edge_list_by_sorting()
+{
+    check_vertex_id_range();
+    mw_replicated_init(&G.num_edges, EL.num_edges);
+    mw_replicated_init(&G.num_vertices, EL.num_vertices);
+    mw_replicated_init(&G.heavy_threshold, LONG_MAX);
+
+    LOG("Initializing distributed vertex list...\n");
+    init_striped_array(&G.vertex_out_degree, G.num_vertices);
+    init_striped_array((long**)&G.vertex_out_neighbors, G.num_vertices);
+    emu_1d_array_apply(G.vertex_out_degree, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        init_degrees_worker
+    );
+    // No vertices are heavy, but is_heavy_out() still needs the bitmap
+    mark_heavy_vertices();
+
+    long edge_list_grain = GLOBAL_GRAIN_MIN(G.num_edges, 64);
+
+    // Count the edges that will be sent to each nodelet
+    LOG("Computing bucket sizes...\n");
+    hooks_region_begin("compute_bucket_sizes");
+    long * bucket_sizes = mw_malloc1dlong(NODELETS());
+    long * bucket_pos = mw_malloc1dlong(NODELETS());
+    assert(bucket_sizes && bucket_pos);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        bucket_sizes[nlet] = 0;
+        bucket_pos[nlet] = 0;
+    }
+    emu_1d_array_apply(EL.src, G.num_edges, edge_list_grain,
+        count_bucket_sizes_worker, bucket_sizes
+    );
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        *(long*)mw_get_nth(&G.num_local_edges, nlet) = bucket_sizes[nlet];
+    }
+    hooks_region_end();
+
+    LOG("Filling buckets...\n");
+    hooks_region_begin("fill_buckets");
+    // Size each bucket to fit its own nodelet's edges, like the edge storage
+    edge ** buckets = (edge**)mw_malloc1dlong(NODELETS());
+    assert(buckets);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        // Always allocate at least one element, even if the bucket is empty
+        buckets[nlet] = mw_localmalloc(sizeof(edge) * (bucket_sizes[nlet] + 1), &bucket_sizes[nlet]);
+        if (buckets[nlet] == NULL) {
+            LOG("Failed to allocate bucket on nodelet %li\n", nlet);
+            exit(1);
+        }
+    }
+    emu_1d_array_apply(EL.src, G.num_edges, edge_list_grain,
+        fill_buckets_worker, buckets, bucket_pos
+    );
+    hooks_region_end();
+
+    LOG("Allocating edge storage...\n");
+    allocate_edge_storage();
+
+    // Each nodelet builds its own edge blocks, with only local memory accesses
+    LOG("Building edge blocks...\n");
+    hooks_region_begin("build_edge_blocks");
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        cilk_spawn_at(buckets[nlet]) build_local_edge_blocks(buckets[nlet], bucket_sizes[nlet], nlet);
+    }
+    cilk_sync;
+    hooks_region_end();
+
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        mw_localfree(buckets[nlet]);
+    }
+    mw_free(buckets);
+    mw_free(bucket_sizes);
+    mw_free(bucket_pos);
+    LOG("...Done\n");
+}
+
+static void
+free_heavy_edge_blocks_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        if (is_heavy_out(v)) {
+            mw_free(G.vertex_out_neighbors[v].repl_edge_block);
+        }
+    }
+}
+
+// Free all memory used by the graph
+void
+graph_deinit()
+{
+    emu_1d_array_apply((long*)G.vertex_out_neighbors, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        free_heavy_edge_blocks_worker
+    );
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        if (G.is_compressed) {
+            mw_localfree(*(uint8_t**)mw_get_nth(&G.compressed_storage, nlet));
+        } else {
+            mw_localfree(*(vertex_id_t**)mw_get_nth(&G.edge_storage, nlet));
+        }
+    }
+    mw_replicated_init(&G.is_compressed, 0);
+    mw_replicated_init(&G.is_oriented, 0);
+    free_segment_storage();
+    bitmap_replicated_deinit(&G.heavy_out);
+    mw_free(G.vertex_out_degree);
+    mw_free(G.vertex_out_neighbors);
+}
+
 void
 count_num_heavy_vertices_worker(long * array, long begin, long end, long * sum, va_list args)
 {
@@ -538,10 +934,12 @@ void print_graph_distribution()
     );
 
     // Compute percentage of edges on each nodelet
+    // Oriented graphs store each edge once instead of twice
+    long num_stored_edges = G.is_oriented ? G.num_edges : G.num_edges * 2;
     double percent_edges[NODELETS()];
     for (long nlet = 0; nlet < NODELETS(); ++nlet) {
         long num_local_edges = *(long*)mw_get_nth(&G.num_local_edges, nlet);
-        percent_edges[nlet] = (double)num_local_edges / (G.num_edges * 2);
+        percent_edges[nlet] = (double)num_local_edges / num_stored_edges;
     }
 
     // Compute the max (to scale the y-axis)
@@ -8,10 +8,37 @@ check_graph();
 void
 construct_graph_from_edge_list(long heavy_threshold);
 
+// Alternative to construct_graph_from_edge_list() that buckets and sorts edges on
+// each nodelet. Edge blocks come out sorted, heavy vertices are not supported
+void
+construct_graph_from_edge_list_by_sorting();
+
+void
+allocate_edge_storage();
+
+void
+mark_heavy_vertices();
+
+void
+graph_deinit();
+
+// Sort vertex ID's in [edges_begin, edges_end) in ascending order
+void
+sort_edge_block(vertex_id_t * edges_begin, vertex_id_t * edges_end);
+
 void
 sort_edge_blocks();
+// Group the edges of each vertex by the nodelet they point to, and record segment
+// offsets for high-degree vertices. If sort_by_id is set, the edges pointing to
+// each nodelet are also sorted by vertex ID
+void
+sort_edge_blocks_by_nodelet(bool sort_by_id);
+// Throw away the segment offsets computed by sort_edge_blocks_by_nodelet()
 void
-sort_edge_blocks_by_nodelet();
+free_segment_storage();
+
+long
+count_num_heavy_vertices();
 
 void
 print_graph_distribution();
@@ -0,0 +1,207 @@
+#include "graph_snapshot.h"
+#include "graph_from_edge_list.h"
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+/**
+ * Graph snapshots
+ * Stores the graph after construction, so later runs can skip straight to the
+ * algorithm. The file has the same layout as G in memory: the vertex array is
+ * split up by nodelet, and the edges for the vertices on each nodelet are
+ * packed together in vertex order.
+ *
+ * File layout:
+ *   graph_snapshot_header
+ *   long num_local_edges[num_nodelets]
+ *   for each nodelet:
+ *     long vertex_out_degree[] for each vertex on the nodelet (nlet, nlet + num_nodelets, ...)
+ *     vertex_id_t edges[num_local_edges[nlet]]
+ *
+ * Since vertices are assigned to nodelets round-robin, a snapshot can only be
+ * loaded on a system with the same number of nodelets, and by a build with the
+ * same vertex ID size (see PAPERWASP_VID32). Heavy vertices are not
+ * supported, since their edges are spread across all nodelets.
+ */
+
+#define GRAPH_SNAPSHOT_MAGIC "PWCSR64"
+
+typedef struct graph_snapshot_header {
+    char magic[8];
+    long num_vertices;
+    long num_edges;
+    long num_nodelets;
+    long vertex_id_size;
+    long is_sorted;
+} graph_snapshot_header;
+
+// Number of vertices that are stored on nodelet nlet
+static inline long
+num_vertices_on_nodelet(long num_vertices, long nlet)
+{
+    if (nlet >= num_vertices) { return 0; }
+    return (num_vertices - nlet + NODELETS() - 1) / NODELETS();
+}
+
+void
+save_graph_snapshot(const char* filename, bool is_sorted)
+{
+    LOG("Saving graph snapshot to %s...\n", filename);
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        LOG("Unable to open %s\n", filename);
+        exit(1);
+    }
+    hooks_region_begin("save_graph_snapshot");
+
+    graph_snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, GRAPH_SNAPSHOT_MAGIC);
+    header.num_vertices = G.num_vertices;
+    header.num_edges = G.num_edges;
+    header.num_nodelets = NODELETS();
+    header.vertex_id_size = sizeof(vertex_id_t);
+    header.is_sorted = is_sorted;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    // Count the edges on each nodelet
+    long num_local_edges[NODELETS()];
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        num_local_edges[nlet] = 0;
+        for (long v = nlet; v < G.num_vertices; v += NODELETS()) {
+            if (is_heavy_out(v)) {
+                LOG("Graph snapshots do not support heavy vertices\n");
+                exit(1);
+            }
+            num_local_edges[nlet] += G.vertex_out_degree[v];
+        }
+    }
+    fwrite(num_local_edges, sizeof(long), NODELETS(), fp);
+
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        // Gather the degrees of the vertices on this nodelet
+        long n = num_vertices_on_nodelet(G.num_vertices, nlet);
+        long * degrees = mw_localmalloc(n * sizeof(long) + 1, &degrees);
+        assert(degrees);
+        for (long i = 0; i < n; ++i) {
+            degrees[i] = G.vertex_out_degree[nlet + i * NODELETS()];
+        }
+        fwrite(degrees, sizeof(long), n, fp);
+        mw_localfree(degrees);
+        // Write out the edges of each vertex, in order
+        for (long v = nlet; v < G.num_vertices; v += NODELETS()) {
+            fwrite(G.vertex_out_neighbors[v].local_edges, sizeof(vertex_id_t), G.vertex_out_degree[v], fp);
+        }
+    }
+    hooks_region_end();
+
+    if (ferror(fp)) {
+        LOG("Failed to write graph snapshot to %s\n", filename);
+        exit(1);
+    }
+    fclose(fp);
+}
+
+// Load the vertices and edges that belong to this nodelet
+// Each nodelet reads its own portion of the file, with one read for the
+// degrees and one read directly into the local edge storage.
+static void
+load_graph_snapshot_worker(const char * filename, long nlet, size_t offset, long num_local_edges)
+{
+    vertex_id_t * edges = *(vertex_id_t**)mw_get_nth(&G.edge_storage, nlet);
+    FILE * fp = mw_fopen(filename, "rb", edges);
+    if (fp == NULL) {
+        LOG("Error opening %s on nodelet %li\n", filename, nlet);
+        exit(1);
+    }
+    if (fseek(fp, offset, SEEK_SET)) {
+        LOG("Error seeking in %s on nodelet %li\n", filename, nlet);
+        exit(1);
+    }
+
+    long n = num_vertices_on_nodelet(G.num_vertices, nlet);
+    long * degrees = mw_localmalloc(n * sizeof(long) + 1, edges);
+    assert(degrees);
+    if (mw_fread(degrees, sizeof(long), n, fp) != (size_t)n
+     || mw_fread(edges, sizeof(vertex_id_t), num_local_edges, fp) != (size_t)num_local_edges) {
+        LOG("Failed to load graph snapshot from %s on nodelet %li\n", filename, nlet);
+        exit(1);
+    }
+    mw_fclose(fp);
+
+    // Point each vertex at its edges
+    long pos = 0;
+    for (long i = 0; i < n; ++i) {
+        long v = nlet + i * NODELETS();
+        G.vertex_out_degree[v] = degrees[i];
+        G.vertex_out_neighbors[v].local_edges = edges + pos;
+        pos += degrees[i];
+    }
+    mw_localfree(degrees);
+    if (pos != num_local_edges) {
+        LOG("Graph snapshot %s is corrupt on nodelet %li\n", filename, nlet);
+        exit(1);
+    }
+    *(vertex_id_t**)mw_get_nth(&G.next_edge_storage, nlet) = edges + pos;
+}
+
+bool
+load_graph_snapshot(const char* filename)
+{
+    LOG("Loading graph snapshot from %s...\n", filename);
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        LOG("Unable to open %s\n", filename);
+        exit(1);
+    }
+    graph_snapshot_header header;
+    if (fread(&header, sizeof(header), 1, fp) != 1
+     || strncmp(header.magic, GRAPH_SNAPSHOT_MAGIC, sizeof(header.magic))) {
+        LOG("%s is not a graph snapshot\n", filename);
+        exit(1);
+    }
+    if (header.num_nodelets != NODELETS()) {
+        LOG("%s was saved with %li nodelets, but there are %li nodelets on this system\n",
+            filename, header.num_nodelets, NODELETS());
+        exit(1);
+    }
+    if (header.vertex_id_size != sizeof(vertex_id_t)) {
+        LOG("%s was saved with %li-byte vertex ID's, but this build uses %li-byte vertex ID's\n",
+            filename, header.vertex_id_size, (long)sizeof(vertex_id_t));
+        exit(1);
+    }
+    long num_local_edges[NODELETS()];
+    if (fread(num_local_edges, sizeof(long), NODELETS(), fp) != (size_t)NODELETS()) {
+        LOG("Failed to read graph snapshot header from %s\n", filename);
+        exit(1);
+    }
+    fclose(fp);
+
+    hooks_region_begin("load_graph_snapshot");
+    mw_replicated_init(&G.num_edges, header.num_edges);
+    mw_replicated_init(&G.num_vertices, header.num_vertices);
+    // Snapshots never contain heavy vertices
+    mw_replicated_init(&G.heavy_threshold, LONG_MAX);
+    init_striped_array(&G.vertex_out_degree, G.num_vertices);
+    init_striped_array((long**)&G.vertex_out_neighbors, G.num_vertices);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        *(long*)mw_get_nth(&G.num_local_edges, nlet) = num_local_edges[nlet];
+    }
+    allocate_edge_storage();
+
+    // Spawn a thread on each nodelet to read its own part of the file
+    size_t offset = sizeof(header) + NODELETS() * sizeof(long);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        cilk_spawn_at(mw_get_nth(&G.edge_storage, nlet))
+            load_graph_snapshot_worker(filename, nlet, offset, num_local_edges[nlet]);
+        offset += num_vertices_on_nodelet(G.num_vertices, nlet) * sizeof(long)
+                + num_local_edges[nlet] * sizeof(vertex_id_t);
+    }
+    cilk_sync;
+    // Snapshots never contain heavy vertices, but is_heavy_out() still needs the bitmap
+    mark_heavy_vertices();
+    hooks_region_end();
+    LOG("Loaded graph with %li vertices and %li edges\n", G.num_vertices, G.num_edges);
+
+    return header.is_sorted;
+}
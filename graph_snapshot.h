@@ -0,0 +1,14 @@
+#pragma once
+
+#include "graph.h"
+
+// Write the constructed graph G to a file, so it can be reloaded without
+// going through construct_graph_from_edge_list()
+// is_sorted records whether the edge blocks have been sorted by vertex ID
+void
+save_graph_snapshot(const char* filename, bool is_sorted);
+
+// Initialize the graph G from a file written by save_graph_snapshot()
+// Returns true if the edge blocks were sorted by vertex ID when they were saved
+bool
+load_graph_snapshot(const char* filename);
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include "ack_control.h"
 #include "cursor.h"
+#include "compressed_graph.h"
 
 // Global replicated struct with BFS data pointers
 replicated hybrid_bfs_data HYBRID_BFS;
@@ -15,20 +16,34 @@ init_parent_worker(long * array, long begin, long end, va_list args)
 {
     (void)array;
     for (long v = begin; v < end; v += NODELETS()) {
-        long out_degree = G.vertex_out_degree[v];
-        HYBRID_BFS.parent[v] = out_degree != 0 ? -out_degree : -1;
+        HYBRID_BFS.parent[v] = -1;
         HYBRID_BFS.new_parent[v] = -1;
     }
 }
 
+static void
+clear_touched_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long i = begin; i < end; i += NODELETS()) {
+        HYBRID_BFS.touched[i] = 0;
+    }
+}
 
+// Prepare for the next search
+// Only needs to sweep the parent array when the epoch counter wraps around
 void
 hybrid_bfs_data_clear()
 {
-    long grain = GLOBAL_GRAIN_MIN(G.num_vertices, 128);
-    emu_1d_array_apply(HYBRID_BFS.parent, G.num_vertices, grain,
-        init_parent_worker
-    );
+    long epoch = HYBRID_BFS.epoch + 1;
+    if (epoch > HYBRID_BFS_MAX_EPOCH) {
+        long grain = GLOBAL_GRAIN_MIN(G.num_vertices, 128);
+        emu_1d_array_apply(HYBRID_BFS.parent, G.num_vertices, grain,
+            init_parent_worker
+        );
+        epoch = 1;
+    }
+    mw_replicated_init(&HYBRID_BFS.epoch, epoch);
     sliding_queue_replicated_reset(&HYBRID_BFS.queue);
 }
 
@@ -45,12 +60,38 @@ scout_count_allreduce()
     mw_replicated_init(&HYBRID_BFS.scout_count, sum);
 }
 
+// Add up all copies of a replicated counter
+static long
+replicated_sum(long * repl)
+{
+    long sum = 0;
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        sum += *(long*)get_nth(repl, nlet);
+    }
+    return sum;
+}
+
 void
 hybrid_bfs_init()
 {
     init_striped_array(&HYBRID_BFS.parent, G.num_vertices);
     init_striped_array(&HYBRID_BFS.new_parent, G.num_vertices);
+    // One bit for each vertex, rounded up to a whole word on each nodelet
+    long num_local_vertices = (G.num_vertices + NODELETS() - 1) / NODELETS();
+    long num_touched_words = NODELETS() * ((num_local_vertices + 63) / 64);
+    mw_replicated_init(&HYBRID_BFS.num_touched_words, num_touched_words);
+    init_striped_array((long**)&HYBRID_BFS.touched, num_touched_words);
+    emu_1d_array_apply((long*)HYBRID_BFS.touched, num_touched_words, GLOBAL_GRAIN_MIN(num_touched_words, 128),
+        clear_touched_worker
+    );
+    // Vertex ID's must fit below the epoch bits
+    assert(G.num_vertices <= (1L << HYBRID_BFS_EPOCH_SHIFT));
+    // Force a full sweep of the parent array on the first clear
+    mw_replicated_init(&HYBRID_BFS.epoch, HYBRID_BFS_MAX_EPOCH);
+    mw_replicated_init(&HYBRID_BFS.trace_enabled, 0);
     sliding_queue_replicated_init(&HYBRID_BFS.queue, G.num_vertices);
+    bitmap_replicated_init(&HYBRID_BFS.frontier, G.num_vertices);
+    bitmap_replicated_init(&HYBRID_BFS.next_frontier, G.num_vertices);
 
     hybrid_bfs_data_clear();
     ack_control_init();
@@ -61,7 +102,10 @@ hybrid_bfs_deinit()
 {
     mw_free(HYBRID_BFS.parent);
     mw_free(HYBRID_BFS.new_parent);
+    mw_free(HYBRID_BFS.touched);
     sliding_queue_replicated_deinit(&HYBRID_BFS.queue);
+    bitmap_replicated_deinit(&HYBRID_BFS.frontier);
+    bitmap_replicated_deinit(&HYBRID_BFS.next_frontier);
 }
 
 
@@ -70,6 +114,8 @@ hybrid_bfs_deinit()
  * Fire off a remote write for each edge in the frontier
  * This write travels to the home node for the destination vertex,
  * setting the source vertex as its parent.
+ * A remote OR also sets the bit for the destination vertex in the touched bitmap,
+ * so only the vertices that were written to need to be checked afterwards.
  * Return the sum of the degrees of the vertices in the new frontier
  *
  * Overview of top_down_step_with_remote_writes()
@@ -79,26 +125,42 @@ hybrid_bfs_deinit()
  *       IF LIGHT VERTEX
  *       call mark_neighbors_parallel() on a local array of edges
  *         call/spawn mark_neighbors() over a local array of edges
+ *       ELSE IF COMPRESSED GRAPH
+ *       call mark_neighbors_compressed_parallel() on the compressed edges
+ *         call/spawn mark_neighbors_compressed() over chunks of the compressed edges
  *       ELSE IF HEAVY VERTEX
  *       spawn mark_neighbors_in_eb() for each remote edge block
  *         call mark_neighbors_parallel() on the local edge block
  *           call/spawn mark_neighbors() over the local edge block
  *   RE-ENABLE ACKS
  *   SYNC
- *   spawn populate_next_frontier() over all vertices
+ *   spawn populate_next_frontier() over the touched bitmap
 */
 
+// Set the bit for this vertex in the touched bitmap
 static inline void
-mark_neighbors(long src, long * edges_begin, long * edges_end)
+mark_touched(long v)
 {
-    for (long * e = edges_begin; e < edges_end; ++e) {
+    long nlet = v % NODELETS();
+    long local_index = v / NODELETS();
+    long word = (local_index >> 6) * NODELETS() + nlet;
+    // Remote atomics only work on signed words, but the bits are the same
+    REMOTE_OR((long*)&HYBRID_BFS.touched[word], (long)(1UL << (local_index & 63)));
+}
+
+static inline void
+mark_neighbors(long src, vertex_id_t * edges_begin, vertex_id_t * edges_end)
+{
+    long encoded_src = hybrid_bfs_encode_parent(src);
+    for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
         long dst = *e;
-        HYBRID_BFS.new_parent[dst] = src; // Remote write
+        HYBRID_BFS.new_parent[dst] = encoded_src; // Remote write
+        mark_touched(dst); // Remote OR
     }
 }
 
 static inline void
-mark_neighbors_parallel(long src, long * edges_begin, long * edges_end)
+mark_neighbors_parallel(long src, vertex_id_t * edges_begin, vertex_id_t * edges_end)
 {
     long degree = edges_end - edges_begin;
     long grain = 512;
@@ -107,14 +169,46 @@ mark_neighbors_parallel(long src, long * edges_begin, long * edges_end)
         mark_neighbors(src, edges_begin, edges_end);
     } else {
         // High-degree local vertex, spawn local threads
-        for (long * e1 = edges_begin; e1 < edges_end; e1 += grain) {
-            long * e2 = e1 + grain;
+        for (vertex_id_t * e1 = edges_begin; e1 < edges_end; e1 += grain) {
+            vertex_id_t * e2 = e1 + grain;
             if (e2 > edges_end) { e2 = edges_end; }
             cilk_spawn mark_neighbors(src, e1, e2);
         }
     }
 }
 
+// Same as mark_neighbors(), for the next n edges of a compressed edge block
+static inline void
+mark_neighbors_compressed(long src, const uint8_t * p, long prev, long n)
+{
+    long encoded_src = hybrid_bfs_encode_parent(src);
+    for (long i = 0; i < n; ++i) {
+        long dst = prev = compressed_next(&p, prev);
+        HYBRID_BFS.new_parent[dst] = encoded_src; // Remote write
+        mark_touched(dst); // Remote OR
+    }
+}
+
+static inline void
+mark_neighbors_compressed_parallel(long src)
+{
+    const uint8_t * p = G.vertex_out_neighbors[src].compressed_edges;
+    long degree = G.vertex_out_degree[src];
+    long grain = 512;
+    if (degree <= grain) {
+        // Low-degree local vertex, handle in this thread
+        mark_neighbors_compressed(src, p, 0, degree);
+    } else {
+        // High-degree local vertex, decode ahead to find where each chunk starts
+        long prev = 0;
+        for (long i = 0; i < degree; i += grain) {
+            long n = degree - i < grain ? degree - i : grain;
+            cilk_spawn mark_neighbors_compressed(src, p, prev, n);
+            compressed_skip(&p, &prev, n);
+        }
+    }
+}
+
 void
 mark_neighbors_in_eb(long src, edge_block * eb)
 {
@@ -126,10 +220,13 @@ mark_queue_neighbors_worker(sliding_queue * queue, long * queue_pos)
 {
     // Keep grabbing vertices off the local queue
     const long queue_end = queue->end;
-    const long * queue_buffer = queue->buffer;
+    const vertex_id_t * queue_buffer = queue->buffer;
+    long local_edges_examined = 0;
     long v = ATOMIC_ADDMS(queue_pos, 1);
     for (; v < queue_end; v = ATOMIC_ADDMS(queue_pos, 1)) {
         long src = queue_buffer[v];
+        // A top-down step examines every out-edge of the frontier
+        if (HYBRID_BFS.trace_enabled) { local_edges_examined += G.vertex_out_degree[src]; }
         // How big is this vertex?
         if (is_heavy_out(src)) {
             // Heavy vertex, spawn a thread for each remote edge block
@@ -138,12 +235,15 @@ mark_queue_neighbors_worker(sliding_queue * queue, long * queue_pos)
                 edge_block * remote_eb = get_nth(eb, i);
                 cilk_spawn_at(remote_eb) mark_neighbors_in_eb(src, remote_eb);
             }
+        } else if (G.is_compressed) {
+            mark_neighbors_compressed_parallel(src);
         } else {
-            long * edges_begin = G.vertex_out_neighbors[src].local_edges;
-            long * edges_end = edges_begin + G.vertex_out_degree[src];
+            vertex_id_t * edges_begin = G.vertex_out_neighbors[src].local_edges;
+            vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[src];
             mark_neighbors_parallel(src, edges_begin, edges_end);
         }
     }
+    if (HYBRID_BFS.trace_enabled) { REMOTE_ADD(&HYBRID_BFS.edges_examined, local_edges_examined); }
 }
 
 void
@@ -165,19 +265,29 @@ mark_queue_neighbors_spawner(sliding_queue * queue)
     ack_control_reenable_acks();
 }
 
-// For each vertex in the graph, detect if it was assigned a parent in this iteration
+// For each vertex in the touched bitmap, detect if it was assigned a parent in this iteration
 static void
 populate_next_frontier(long * array, long begin, long end, va_list args)
 {
     long local_scout_count = 0;
-    for (long i = begin; i < end; i += NODELETS()) {
-        if (HYBRID_BFS.parent[i] < 0 && HYBRID_BFS.new_parent[i] >= 0) {
-            // Update count with degree of new vertex
-            local_scout_count += -HYBRID_BFS.parent[i];
-            // Set parent
-            HYBRID_BFS.parent[i] = HYBRID_BFS.new_parent[i];
-            // Add to the queue for the next frontier
-            sliding_queue_push_back(&HYBRID_BFS.queue, i);
+    const long nodelets = NODELETS();
+    for (long i = begin; i < end; i += nodelets) {
+        unsigned long word = HYBRID_BFS.touched[i];
+        if (word == 0) { continue; }
+        HYBRID_BFS.touched[i] = 0;
+        // Bit b of this word is the vertex with local index (first_local_index + b)
+        long first_local_index = (i / nodelets) * 64;
+        long nlet = i % nodelets;
+        for (; word != 0; word &= word - 1) {
+            long v = (first_local_index + __builtin_ctzl(word)) * nodelets + nlet;
+            if (!hybrid_bfs_is_visited(HYBRID_BFS.parent[v])) {
+                // Update count with degree of new vertex
+                local_scout_count += G.vertex_out_degree[v];
+                // Set parent
+                HYBRID_BFS.parent[v] = HYBRID_BFS.new_parent[v];
+                // Add to the queue for the next frontier
+                sliding_queue_push_back(&HYBRID_BFS.queue, v);
+            }
         }
     }
     // Update global count
@@ -196,7 +306,8 @@ top_down_step_with_remote_writes()
     cilk_sync;
     // Add to the queue all vertices that didn't have a parent before
     mw_replicated_init(&HYBRID_BFS.scout_count, 0);
-    emu_1d_array_apply(HYBRID_BFS.parent, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 128),
+    emu_1d_array_apply((long*)HYBRID_BFS.touched, HYBRID_BFS.num_touched_words,
+        GLOBAL_GRAIN_MIN(HYBRID_BFS.num_touched_words, 16),
         populate_next_frontier
     );
     scout_count_allreduce();
@@ -215,6 +326,11 @@ top_down_step_with_remote_writes()
  *       IF LIGHT VERTEX
  *       call explore_frontier_parallel() on a local array of edges
  *         call/spawn frontier_visitor over a local array of edges
+ *       ELSE IF LIGHT VERTEX WITH SEGMENTS
+ *       spawn explore_frontier_parallel() for each nodelet segment of the local array
+ *       ELSE IF COMPRESSED GRAPH
+ *       call explore_frontier_compressed_parallel() on the compressed edges
+ *         call/spawn frontier_visitor_compressed() over chunks of the compressed edges
  *       ELSE IF HEAVY VERTEX
  *       spawns explore_frontier_in_eb() for each remote edge block
  *         call explore_frontier_parallel() on the local edge block
@@ -228,19 +344,20 @@ visit(long src, long dst)
     long * parent = &HYBRID_BFS.parent[dst];
     long curr_val = *parent;
     // If we are the first to visit this vertex
-    if (curr_val < 0) {
+    if (!hybrid_bfs_is_visited(curr_val)) {
         // Set self as parent of this vertex
-        if (ATOMIC_CAS(parent, src, curr_val) == curr_val) {
+        if (ATOMIC_CAS(parent, hybrid_bfs_encode_parent(src), curr_val) == curr_val) {
             // Add it to the queue
             sliding_queue_push_back(&HYBRID_BFS.queue, dst);
-            REMOTE_ADD(&HYBRID_BFS.scout_count, -curr_val);
+            // Degree is stored on the same nodelet as the parent
+            REMOTE_ADD(&HYBRID_BFS.scout_count, G.vertex_out_degree[dst]);
         }
     }
 }
 
 // Using noinline to minimize the size of the migrating context
 static __attribute__((always_inline)) inline void
-frontier_visitor(long src, long * edges_begin, long * edges_end)
+frontier_visitor(long src, vertex_id_t * edges_begin, vertex_id_t * edges_end)
 {
     long e1, e2, e3, e4;
 
@@ -249,7 +366,7 @@ frontier_visitor(long src, long * edges_begin, long * edges_end)
         visit(src, *edges_begin++);
     }
 
-    for (long * e = edges_begin; e < edges_end;) {
+    for (vertex_id_t * e = edges_begin; e < edges_end;) {
         // Pick up four edges
         e4 = *e++;
         e3 = *e++;
@@ -266,7 +383,7 @@ frontier_visitor(long src, long * edges_begin, long * edges_end)
 }
 
 static inline void
-explore_frontier_parallel(long src, long * edges_begin, long * edges_end)
+explore_frontier_parallel(long src, vertex_id_t * edges_begin, vertex_id_t * edges_end)
 {
     long degree = edges_end - edges_begin;
     long grain = 64;
@@ -276,26 +393,107 @@ explore_frontier_parallel(long src, long * edges_begin, long * edges_end)
         frontier_visitor(src, edges_begin, edges_end);
     } else {
         // High-degree local vertex, spawn local threads
-        for (long * e1 = edges_begin; e1 < edges_end; e1 += grain) {
-            long * e2 = e1 + grain;
+        for (vertex_id_t * e1 = edges_begin; e1 < edges_end; e1 += grain) {
+            vertex_id_t * e2 = e1 + grain;
             if (e2 > edges_end) { e2 = edges_end; }
             cilk_spawn frontier_visitor(src, e1, e2);
         }
     }
 }
 
+// Same as frontier_visitor(), for the next n edges of a compressed edge block
+static __attribute__((always_inline)) inline void
+frontier_visitor_compressed(long src, const uint8_t * p, long prev, long n)
+{
+    long e1, e2, e3, e4;
+
+    // Visit neighbors one at a time until remainder is evenly divisible by four
+    for (; n % 4 != 0; --n) {
+        prev = compressed_next(&p, prev);
+        visit(src, prev);
+    }
+
+    for (; n > 0; n -= 4) {
+        // Decode four edges
+        e4 = compressed_next(&p, prev);
+        e3 = compressed_next(&p, e4);
+        e2 = compressed_next(&p, e3);
+        e1 = compressed_next(&p, e2);
+        prev = e1;
+        // Visit each neighbor without returning home
+        visit(src, e1); RESIZE();
+        visit(src, e2); RESIZE();
+        visit(src, e3); RESIZE();
+        visit(src, e4); RESIZE();
+    }
+}
+
+static inline void
+explore_frontier_compressed_parallel(long src)
+{
+    const uint8_t * p = G.vertex_out_neighbors[src].compressed_edges;
+    long degree = G.vertex_out_degree[src];
+    long grain = 64;
+    if (degree <= grain) {
+        // Low-degree local vertex, handle in this thread
+        frontier_visitor_compressed(src, p, 0, degree);
+    } else {
+        // High-degree local vertex, decode ahead to find where each chunk starts
+        long prev = 0;
+        for (long i = 0; i < degree; i += grain) {
+            long n = degree - i < grain ? degree - i : grain;
+            cilk_spawn frontier_visitor_compressed(src, p, prev, n);
+            compressed_skip(&p, &prev, n);
+        }
+    }
+}
+
+// Calls explore_frontier_parallel over a remote edge block
+void
+explore_frontier_in_eb(long src, edge_block * eb)
+{
+    explore_frontier_parallel(src, eb->edges, eb->edges + eb->num_edges);
+}
+
 void
 explore_frontier_worker(sliding_queue * queue, long * queue_pos)
 {
     const long queue_end = queue->end;
-    const long * queue_buffer = queue->buffer;
+    const vertex_id_t * queue_buffer = queue->buffer;
+    long local_edges_examined = 0;
     long v = ATOMIC_ADDMS(queue_pos, 1);
     for (; v < queue_end; v = ATOMIC_ADDMS(queue_pos, 1)) {
         long src = queue_buffer[v];
-        long * edges_begin = G.vertex_out_neighbors[src].local_edges;
-        long * edges_end = edges_begin + G.vertex_out_degree[src];
-        explore_frontier_parallel(src, edges_begin, edges_end);
+        // A top-down step examines every out-edge of the frontier
+        if (HYBRID_BFS.trace_enabled) { local_edges_examined += G.vertex_out_degree[src]; }
+        // How big is this vertex?
+        if (is_heavy_out(src)) {
+            // Heavy vertex, spawn a thread for each remote edge block
+            edge_block * eb = G.vertex_out_neighbors[src].repl_edge_block;
+            for (long i = 0; i < NODELETS(); ++i) {
+                edge_block * remote_eb = get_nth(eb, i);
+                cilk_spawn_at(remote_eb) explore_frontier_in_eb(src, remote_eb);
+            }
+        } else if (G.is_compressed) {
+            explore_frontier_compressed_parallel(src);
+        } else {
+            vertex_id_t * edges_begin = G.vertex_out_neighbors[src].local_edges;
+            vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[src];
+            long * segments = get_out_segments(src);
+            if (segments) {
+                // Edges are grouped by nodelet, spawn a thread for each segment
+                // Each thread only moves back and forth between two nodelets
+                for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+                    if (segments[nlet] == segments[nlet + 1]) { continue; }
+                    cilk_spawn explore_frontier_parallel(src,
+                        edges_begin + segments[nlet], edges_begin + segments[nlet + 1]);
+                }
+            } else {
+                explore_frontier_parallel(src, edges_begin, edges_end);
+            }
+        }
     }
+    if (HYBRID_BFS.trace_enabled) { REMOTE_ADD(&HYBRID_BFS.edges_examined, local_edges_examined); }
 }
 
 void
@@ -335,7 +533,7 @@ dump_queue_stats()
     for (long n = 0; n < NODELETS(); ++n) {
         sliding_queue * local_queue = get_nth(&HYBRID_BFS.queue, n);
         for (long i = local_queue->start; i < local_queue->end; ++i) {
-            printf("%li ", local_queue->buffer[i]);
+            printf("%li ", (long)local_queue->buffer[i]);
         }
     }
     printf("\n");
@@ -370,6 +568,8 @@ dump_queue_stats()
  * For each vertex that is not yet a part of the BFS tree,
  * check all in-neighbors to see if they are in the current frontier
  * If a parent is found, put the child in the next frontier
+ * Children are appended to the local queue as they find a parent, so only
+ * those vertices need to be updated at the end of the step.
  * Returns the number of vertices that found a parent (size of next frontier)
  *
  * Overview of bottom_up_step()
@@ -382,42 +582,74 @@ dump_queue_stats()
  *       spawn search_for_parent_in_eb() at each remote edge block
  *         call search_for_parent_parallel() on the local edge block
  *           call/spawn search_for_parent() over the local edge block
+ *   spawn commit_new_parents() on each nodelet
+ *     spawn commit_new_parents_worker() over the new entries in the local queue
  *
 */
 
 static __attribute__((always_inline)) inline void
-search_for_parent(long child, long * edges_begin, long * edges_end, long * awake_count)
+search_for_parent(long child, vertex_id_t * edges_begin, vertex_id_t * edges_end, long * awake_count, long * edges_examined)
 {
     // For each vertex connected to me...
-    for (long * e = edges_begin; e < edges_end; ++e) {
+    for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
         long parent = *e;
         // If the vertex is in the frontier...
-        if ((HYBRID_BFS.parent[parent] >= 0)) {
+        if (hybrid_bfs_is_visited(HYBRID_BFS.parent[parent])) {
             // Claim as a parent
-            HYBRID_BFS.new_parent[child] = parent;
+            HYBRID_BFS.new_parent[child] = hybrid_bfs_encode_parent(parent);
             // Increment number of vertices woken up on this step
             REMOTE_ADD(awake_count, 1);
             // No need to keep looking for a parent
-            break;
+            *edges_examined += (e - edges_begin) + 1;
+            return;
         }
     }
+    *edges_examined += edges_end - edges_begin;
+}
+
+// Same as search_for_parent(), over the compressed edges of the child
+static __attribute__((always_inline)) inline void
+search_for_parent_compressed(long child, long * awake_count, long * edges_examined)
+{
+    const uint8_t * p = G.vertex_out_neighbors[child].compressed_edges;
+    long degree = G.vertex_out_degree[child];
+    long parent = 0;
+    for (long i = 0; i < degree; ++i) {
+        parent = compressed_next(&p, parent);
+        if (hybrid_bfs_is_visited(HYBRID_BFS.parent[parent])) {
+            HYBRID_BFS.new_parent[child] = hybrid_bfs_encode_parent(parent);
+            REMOTE_ADD(awake_count, 1);
+            *edges_examined += i + 1;
+            return;
+        }
+    }
+    *edges_examined += degree;
+}
+
+// Calls search_for_parent in a spawned thread, which keeps its own count of edges examined
+static void
+search_for_parent_in_chunk(long child, vertex_id_t * edges_begin, vertex_id_t * edges_end, long * awake_count)
+{
+    long edges_examined = 0;
+    search_for_parent(child, edges_begin, edges_end, awake_count, &edges_examined);
+    if (HYBRID_BFS.trace_enabled) { REMOTE_ADD(&HYBRID_BFS.edges_examined, edges_examined); }
 }
 
 static inline void
-search_for_parent_parallel(long child, long * edges_begin, long * edges_end, long * awake_count)
+search_for_parent_parallel(long child, vertex_id_t * edges_begin, vertex_id_t * edges_end, long * awake_count, long * edges_examined)
 {
     long degree = edges_end - edges_begin;
     long grain = 512;
     if (degree <= grain) {
         // Low-degree local vertex, handle in this thread
-        search_for_parent(child, edges_begin, edges_end, awake_count);
+        search_for_parent(child, edges_begin, edges_end, awake_count, edges_examined);
     } else {
         // High-degree local vertex, spawn local threads
         long num_found = 0;
-        for (long * e1 = edges_begin; e1 < edges_end; e1 += grain) {
-            long * e2 = e1 + grain;
+        for (vertex_id_t * e1 = edges_begin; e1 < edges_end; e1 += grain) {
+            vertex_id_t * e2 = e1 + grain;
             if (e2 > edges_end) { e2 = edges_end; }
-            cilk_spawn search_for_parent(child, e1, e2, &num_found);
+            cilk_spawn search_for_parent_in_chunk(child, e1, e2, &num_found);
         }
         cilk_sync;
         // If multiple parents were found, we only increment the counter once
@@ -431,7 +663,9 @@ search_for_parent_parallel(long child, long * edges_begin, long * edges_end, lon
 void
 search_for_parent_in_eb(long child, edge_block * eb, long * awake_count)
 {
-    search_for_parent_parallel(child, eb->edges, eb->edges + eb->num_edges, awake_count);
+    long edges_examined = 0;
+    search_for_parent_parallel(child, eb->edges, eb->edges + eb->num_edges, awake_count, &edges_examined);
+    if (HYBRID_BFS.trace_enabled) { REMOTE_ADD(&HYBRID_BFS.edges_examined, edges_examined); }
 }
 
 void
@@ -445,8 +679,9 @@ search_for_parent_in_remote_ebs(long v, long * awake_count)
         cilk_spawn_at(remote_eb) search_for_parent_in_eb(v, remote_eb, &num_found);
     }
     cilk_sync;
-    // If multiple parents were found, we only increment the counter once
+    // If multiple parents were found, we only add the child to the queue once
     if (num_found > 0) {
+        sliding_queue_push_back(&HYBRID_BFS.queue, v);
         REMOTE_ADD(awake_count, 1);
     }
 }
@@ -458,39 +693,494 @@ search_for_parent_worker(long * array, long begin, long end, va_list args)
     long * awake_count = va_arg(args, long*);
     // For each vertex in our slice of the queue...
     long local_awake_count = 0;
+    long local_edges_examined = 0;
     for (long v = begin; v < end; v += NODELETS()) {
-        if (HYBRID_BFS.parent[v] < 0) {
+        if (!hybrid_bfs_is_visited(HYBRID_BFS.parent[v])) {
             // How big is this vertex?
             if (is_heavy_out(v)) {
                 // Heavy vertex, spawn a thread for each remote edge block
                 cilk_spawn search_for_parent_in_remote_ebs(v, &local_awake_count);
             } else {
-                long * edges_begin = G.vertex_out_neighbors[v].local_edges;
-                long * edges_end = edges_begin + G.vertex_out_degree[v];
-                search_for_parent(v, edges_begin, edges_end, &local_awake_count);
+                vertex_id_t * edges_begin = G.vertex_out_neighbors[v].local_edges;
+                vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[v];
+                long num_found = 0;
+                if (G.is_compressed) {
+                    search_for_parent_compressed(v, &num_found, &local_edges_examined);
+                } else {
+                    search_for_parent(v, edges_begin, edges_end, &num_found, &local_edges_examined);
+                }
+                if (num_found > 0) {
+                    sliding_queue_push_back(&HYBRID_BFS.queue, v);
+                    REMOTE_ADD(&local_awake_count, 1);
+                }
             }
         }
     }
     cilk_sync;
     // Update global count
     REMOTE_ADD(awake_count, local_awake_count);
+    if (HYBRID_BFS.trace_enabled) { REMOTE_ADD(&HYBRID_BFS.edges_examined, local_edges_examined); }
+}
+
+static void
+commit_new_parents_worker(long begin, long end, va_list args)
+{
+    sliding_queue * queue = va_arg(args, sliding_queue*);
+    for (long i = begin; i < end; ++i) {
+        long v = queue->buffer[i];
+        HYBRID_BFS.parent[v] = HYBRID_BFS.new_parent[v];
+    }
+}
+
+// Set the parent of each vertex that was added to the local queue during this step
+static void
+commit_new_parents(sliding_queue * queue)
+{
+    // New entries are past the end of the current window
+    long num_new = queue->next - queue->end;
+    emu_local_for(queue->end, queue->next, LOCAL_GRAIN_MIN(num_new, 256),
+        commit_new_parents_worker, queue
+    );
 }
 
 static long
 bottom_up_step()
 {
     long awake_count = 0;
-    // ALl unconnected vertices search for a neighbor in the frontier
+    // All unconnected vertices search for a neighbor in the frontier
     emu_1d_array_apply(HYBRID_BFS.parent, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 128),
         search_for_parent_worker, &awake_count
     );
-    // Add to the queue all vertices that didn't have a parent before
+    // Set the parent of every vertex that was added to the queue
+    for (long n = 0; n < NODELETS(); ++n) {
+        sliding_queue * local_queue = get_nth(&HYBRID_BFS.queue, n);
+        cilk_spawn_at(local_queue) commit_new_parents(local_queue);
+    }
+    cilk_sync;
+    return awake_count;
+}
+
+/**
+ * Bottom-up BFS step ("bitmap" variant)
+ * Same as bottom_up_step(), but each nodelet checks membership in the current
+ * frontier with a lookup into its own copy of a replicated bitmap, instead of
+ * migrating to read the parent of each in-neighbor.
+ * Since the frontier is tracked separately, a child can be attached to its
+ * parent right away, without waiting for the end of the step.
+ * Returns the number of vertices that found a parent (size of next frontier)
+ *
+ * Overview of bottom_up_step_with_bitmap()
+ *   spawn search_for_parent_in_bitmap_worker() over the entire vertex list
+ *     IF LIGHT VERTEX
+ *     call search_for_parent_in_bitmap() on a local array of edges
+ *     ELSE IF HEAVY VERTEX
+ *     spawn search_for_parent_in_remote_ebs_with_bitmap()
+ *       spawn search_for_parent_in_eb_with_bitmap() at each remote edge block
+ *         call search_for_parent_in_bitmap() on the local edge block
+ *   SYNC next frontier bitmap across all nodelets
+ *   SWAP current and next frontier bitmaps
+*/
+
+static void
+queue_to_bitmap_worker(long begin, long end, va_list args)
+{
+    sliding_queue * queue = va_arg(args, sliding_queue*);
+    for (long i = begin; i < end; ++i) {
+        bitmap_set_bit(&HYBRID_BFS.frontier, queue->buffer[i]);
+    }
+}
+
+static void
+queue_to_bitmap(sliding_queue * queue)
+{
+    long queue_size = sliding_queue_size(queue);
+    emu_local_for(queue->start, queue->end, LOCAL_GRAIN_MIN(queue_size, 256),
+        queue_to_bitmap_worker, queue
+    );
+}
+
+// Initialize the frontier bitmap from the current contents of the queue
+static void
+frontier_bitmap_from_queue()
+{
+    bitmap_replicated_clear(&HYBRID_BFS.frontier);
+    bitmap_replicated_clear(&HYBRID_BFS.next_frontier);
+    // Each nodelet sets bits in its local copy for the vertices in its queue
+    for (long n = 0; n < NODELETS(); ++n) {
+        sliding_queue * local_queue = get_nth(&HYBRID_BFS.queue, n);
+        cilk_spawn_at(local_queue) queue_to_bitmap(local_queue);
+    }
+    cilk_sync;
+    // Combine with all other copies
+    bitmap_replicated_sync(&HYBRID_BFS.frontier);
+}
+
+static __attribute__((always_inline)) inline bool
+search_for_parent_in_bitmap(long child, vertex_id_t * edges_begin, vertex_id_t * edges_end, long * edges_examined)
+{
+    // For each vertex connected to me...
+    for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
+        long parent = *e;
+        // If the vertex is in the frontier... (local lookup)
+        if (bitmap_get_bit(&HYBRID_BFS.frontier, parent)) {
+            // Claim as a parent
+            HYBRID_BFS.parent[child] = hybrid_bfs_encode_parent(parent);
+            // No need to keep looking for a parent
+            *edges_examined += (e - edges_begin) + 1;
+            return true;
+        }
+    }
+    *edges_examined += edges_end - edges_begin;
+    return false;
+}
+
+// Same as search_for_parent_in_bitmap(), over the compressed edges of the child
+static __attribute__((always_inline)) inline bool
+search_for_parent_in_bitmap_compressed(long child, long * edges_examined)
+{
+    const uint8_t * p = G.vertex_out_neighbors[child].compressed_edges;
+    long degree = G.vertex_out_degree[child];
+    long parent = 0;
+    for (long i = 0; i < degree; ++i) {
+        parent = compressed_next(&p, parent);
+        if (bitmap_get_bit(&HYBRID_BFS.frontier, parent)) {
+            HYBRID_BFS.parent[child] = hybrid_bfs_encode_parent(parent);
+            *edges_examined += i + 1;
+            return true;
+        }
+    }
+    *edges_examined += degree;
+    return false;
+}
+
+// Add a vertex that found a parent to the next frontier
+static inline void
+wake_up(long v)
+{
+    bitmap_set_bit(&HYBRID_BFS.next_frontier, v);
+    sliding_queue_push_back(&HYBRID_BFS.queue, v);
+}
+
+// Calls search_for_parent_in_bitmap over a remote edge block
+void
+search_for_parent_in_eb_with_bitmap(long child, edge_block * eb, long * num_found)
+{
+    vertex_id_t * edges_begin = eb->edges;
+    vertex_id_t * edges_end = edges_begin + eb->num_edges;
+    long edges_examined = 0;
+    if (search_for_parent_in_bitmap(child, edges_begin, edges_end, &edges_examined)) {
+        REMOTE_ADD(num_found, 1);
+    }
+    if (HYBRID_BFS.trace_enabled) { REMOTE_ADD(&HYBRID_BFS.edges_examined, edges_examined); }
+}
+
+void
+search_for_parent_in_remote_ebs_with_bitmap(long v, long * awake_count)
+{
+    // Heavy vertex, spawn a thread for each remote edge block
+    long num_found = 0;
+    edge_block * eb = G.vertex_out_neighbors[v].repl_edge_block;
+    for (long i = 0; i < NODELETS(); ++i) {
+        edge_block * remote_eb = get_nth(eb, i);
+        cilk_spawn_at(remote_eb) search_for_parent_in_eb_with_bitmap(v, remote_eb, &num_found);
+    }
+    cilk_sync;
+    // If multiple parents were found, we only wake up once
+    if (num_found > 0) {
+        wake_up(v);
+        REMOTE_ADD(awake_count, 1);
+    }
+}
+
+// Spawns threads to call search_for_parent_in_bitmap for a part of the vertex list
+void
+search_for_parent_in_bitmap_worker(long * array, long begin, long end, va_list args)
+{
+    long * awake_count = va_arg(args, long*);
+    // For each vertex in our slice of the vertex list...
+    long local_awake_count = 0;
+    long local_edges_examined = 0;
+    for (long v = begin; v < end; v += NODELETS()) {
+        if (!hybrid_bfs_is_visited(HYBRID_BFS.parent[v])) {
+            // How big is this vertex?
+            if (is_heavy_out(v)) {
+                // Heavy vertex, spawn a thread for each remote edge block
+                cilk_spawn search_for_parent_in_remote_ebs_with_bitmap(v, &local_awake_count);
+            } else {
+                vertex_id_t * edges_begin = G.vertex_out_neighbors[v].local_edges;
+                vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[v];
+                bool found = G.is_compressed
+                    ? search_for_parent_in_bitmap_compressed(v, &local_edges_examined)
+                    : search_for_parent_in_bitmap(v, edges_begin, edges_end, &local_edges_examined);
+                if (found) {
+                    wake_up(v);
+                    REMOTE_ADD(&local_awake_count, 1);
+                }
+            }
+        }
+    }
+    cilk_sync;
+    // Update global count
+    REMOTE_ADD(awake_count, local_awake_count);
+    if (HYBRID_BFS.trace_enabled) { REMOTE_ADD(&HYBRID_BFS.edges_examined, local_edges_examined); }
+}
+
+static long
+bottom_up_step_with_bitmap()
+{
+    long awake_count = 0;
+    // All unconnected vertices search for a neighbor in the frontier
     emu_1d_array_apply(HYBRID_BFS.parent, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 128),
-        populate_next_frontier
+        search_for_parent_in_bitmap_worker, &awake_count
     );
+    // Share the newly awakened vertices with every nodelet, then make them the current frontier
+    bitmap_replicated_sync(&HYBRID_BFS.next_frontier);
+    bitmap_replicated_swap(&HYBRID_BFS.frontier, &HYBRID_BFS.next_frontier);
+    bitmap_replicated_clear(&HYBRID_BFS.next_frontier);
     return awake_count;
 }
 
+/**
+ * Per-level tracing
+ * When enabled, the run functions record the direction, frontier size,
+ * edge counts and elapsed time of every step. Records are kept for all
+ * searches until the trace is written out.
+ * When disabled, each step only pays for a single branch, and the workers
+ * skip counting edges (HYBRID_BFS.trace_enabled).
+ *
+ * Usage:
+ *   trace_step_begin(step type)
+ *   do the step
+ *   trace_step_end()
+ *   slide queue windows
+ */
+
+typedef struct hybrid_bfs_trace {
+    bool enabled;
+    // Number of searches completed since tracing was enabled
+    long num_searches;
+    // Source and current level of the search in progress
+    long source;
+    long level;
+    // Start time of the step in progress
+    double step_start_ms;
+    // Growable array of records
+    long num_levels;
+    long capacity;
+    hybrid_bfs_level_trace * levels;
+} hybrid_bfs_trace;
+
+static hybrid_bfs_trace TRACE;
+
+void
+hybrid_bfs_trace_enable()
+{
+    TRACE.enabled = true;
+    // Replicated copy of the flag, so the step workers can check it locally
+    mw_replicated_init(&HYBRID_BFS.trace_enabled, 1);
+    TRACE.num_searches = 0;
+    TRACE.num_levels = 0;
+    TRACE.capacity = 64;
+    TRACE.levels = malloc(TRACE.capacity * sizeof(hybrid_bfs_level_trace));
+    assert(TRACE.levels);
+}
+
+void
+hybrid_bfs_trace_deinit()
+{
+    for (long i = 0; i < TRACE.num_levels; ++i) {
+        free(TRACE.levels[i].frontier_size);
+    }
+    free(TRACE.levels);
+    TRACE.levels = NULL;
+    TRACE.num_levels = 0;
+    TRACE.capacity = 0;
+    TRACE.enabled = false;
+    mw_replicated_init(&HYBRID_BFS.trace_enabled, 0);
+}
+
+static void
+trace_search_begin(long source)
+{
+    if (!TRACE.enabled) { return; }
+    TRACE.source = source;
+    TRACE.level = 0;
+}
+
+static void
+trace_search_end()
+{
+    if (!TRACE.enabled) { return; }
+    TRACE.num_searches += 1;
+}
+
+// Record the current frontier, then start timing the step
+static void
+trace_step_begin(hybrid_bfs_step_type step)
+{
+    if (!TRACE.enabled) { return; }
+    if (TRACE.num_levels == TRACE.capacity) {
+        TRACE.capacity *= 2;
+        TRACE.levels = realloc(TRACE.levels, TRACE.capacity * sizeof(hybrid_bfs_level_trace));
+        assert(TRACE.levels);
+    }
+    hybrid_bfs_level_trace * t = &TRACE.levels[TRACE.num_levels];
+    t->search = TRACE.num_searches;
+    t->source = TRACE.source;
+    t->level = TRACE.level;
+    t->step = step;
+    t->scout_count = HYBRID_BFS.scout_count;
+    t->frontier_size = malloc(NODELETS() * sizeof(long));
+    assert(t->frontier_size);
+    for (long n = 0; n < NODELETS(); ++n) {
+        sliding_queue * local_queue = get_nth(&HYBRID_BFS.queue, n);
+        t->frontier_size[n] = sliding_queue_size(local_queue);
+    }
+    t->edges_examined = 0;
+    mw_replicated_init(&HYBRID_BFS.edges_examined, 0);
+    TRACE.step_start_ms = timestamp_ms();
+}
+
+// Stop timing the step and record the size of the next frontier
+// Must be called before sliding the queue windows
+static void
+trace_step_end()
+{
+    if (!TRACE.enabled) { return; }
+    double step_end_ms = timestamp_ms();
+    hybrid_bfs_level_trace * t = &TRACE.levels[TRACE.num_levels];
+    t->time_ms = step_end_ms - TRACE.step_start_ms;
+    // Vertices pushed to the queue during this step form the next frontier
+    long awake_count = 0;
+    for (long n = 0; n < NODELETS(); ++n) {
+        sliding_queue * local_queue = get_nth(&HYBRID_BFS.queue, n);
+        awake_count += local_queue->next - local_queue->end;
+    }
+    t->awake_count = awake_count;
+    // Each step counts the edges it examines as it goes
+    t->edges_examined = replicated_sum(&HYBRID_BFS.edges_examined);
+    TRACE.num_levels += 1;
+    TRACE.level += 1;
+}
+
+static const char *
+step_type_name(hybrid_bfs_step_type step)
+{
+    switch (step) {
+        case TOP_DOWN_MIGRATING_THREADS: return "top_down_migrating_threads";
+        case TOP_DOWN_REMOTE_WRITES: return "top_down_remote_writes";
+        case BOTTOM_UP: return "bottom_up";
+        case BOTTOM_UP_BITMAP: return "bottom_up_bitmap";
+    }
+    return "unknown";
+}
+
+/**
+ * Write all trace records to a file in CSV format, one line per level
+ * The frontier size on each nodelet is written in a separate column
+ */
+void
+hybrid_bfs_trace_write_csv(FILE * fp)
+{
+    fprintf(fp, "search,source,level,step,scout_count,awake_count,edges_examined,time_ms,frontier_size");
+    for (long n = 0; n < NODELETS(); ++n) {
+        fprintf(fp, ",frontier_size_nlet%li", n);
+    }
+    fprintf(fp, "\n");
+    for (long i = 0; i < TRACE.num_levels; ++i) {
+        hybrid_bfs_level_trace * t = &TRACE.levels[i];
+        long frontier_size = 0;
+        for (long n = 0; n < NODELETS(); ++n) {
+            frontier_size += t->frontier_size[n];
+        }
+        fprintf(fp, "%li,%li,%li,%s,%li,%li,%li,%f,%li",
+            t->search, t->source, t->level, step_type_name(t->step),
+            t->scout_count, t->awake_count, t->edges_examined, t->time_ms,
+            frontier_size
+        );
+        for (long n = 0; n < NODELETS(); ++n) {
+            fprintf(fp, ",%li", t->frontier_size[n]);
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+/**
+ * Cost model for switching from top-down to bottom-up
+ * The static rule (scout_count > edges_to_check / alpha) assumes a fixed ratio
+ * between the cost of checking an edge in each direction. When the cost model
+ * is enabled, the beamer variants time their steps and learn the actual costs:
+ *   - top-down: time per edge in the frontier
+ *   - bottom-up: time of the first step after a switch, per unexplored edge
+ * Then they switch when the predicted time of the next top-down step is larger
+ * than that of a bottom-up step. The static rule is used until both costs
+ * have been measured. Measurements are kept across searches.
+ * Only the forward switch uses the cost model, switching back is still
+ * controlled by beta.
+ */
+
+typedef struct hybrid_bfs_cost_model {
+    bool enabled;
+    // Total time and number of frontier edges over all measured top-down steps
+    double top_down_time_ms;
+    long top_down_edges;
+    // Total time of the first bottom-up step after each switch,
+    // and the number of unexplored edges at the time of the switch
+    double bottom_up_time_ms;
+    long bottom_up_edges;
+} hybrid_bfs_cost_model;
+
+static hybrid_bfs_cost_model COST_MODEL;
+
+void
+hybrid_bfs_cost_model_enable()
+{
+    COST_MODEL.enabled = true;
+    COST_MODEL.top_down_time_ms = 0;
+    COST_MODEL.top_down_edges = 0;
+    COST_MODEL.bottom_up_time_ms = 0;
+    COST_MODEL.bottom_up_edges = 0;
+}
+
+static double
+cost_model_timestamp()
+{
+    if (!COST_MODEL.enabled) { return 0; }
+    return timestamp_ms();
+}
+
+// Record the time of a top-down step that examined num_edges edges
+static void
+cost_model_add_top_down(double start_ms, long num_edges)
+{
+    if (!COST_MODEL.enabled || num_edges <= 0) { return; }
+    COST_MODEL.top_down_time_ms += timestamp_ms() - start_ms;
+    COST_MODEL.top_down_edges += num_edges;
+}
+
+// Record the time of a bottom-up step, started when num_edges edges were unexplored
+static void
+cost_model_add_bottom_up(double start_ms, long num_edges)
+{
+    if (!COST_MODEL.enabled || num_edges <= 0) { return; }
+    COST_MODEL.bottom_up_time_ms += timestamp_ms() - start_ms;
+    COST_MODEL.bottom_up_edges += num_edges;
+}
+
+// Should the next step be bottom-up?
+static bool
+switch_to_bottom_up(long scout_count, long edges_to_check, long alpha)
+{
+    if (COST_MODEL.enabled
+        && COST_MODEL.top_down_edges > 0
+        && COST_MODEL.bottom_up_edges > 0) {
+        double top_down_cost = COST_MODEL.top_down_time_ms / COST_MODEL.top_down_edges;
+        double bottom_up_cost = COST_MODEL.bottom_up_time_ms / COST_MODEL.bottom_up_edges;
+        return scout_count * top_down_cost > edges_to_check * bottom_up_cost;
+    }
+    return scout_count > edges_to_check / alpha;
+}
+
 /**
  * Run BFS using Scott Beamer's direction-optimizing algorithm
  *  1. Do top-down steps with migrating threads until condition is met
@@ -505,37 +1195,108 @@ hybrid_bfs_run_beamer (long source, long alpha, long beta)
     // Start with the source vertex in the first frontier, at level 0, and mark it as visited
     sliding_queue_push_back(get_nth(&HYBRID_BFS.queue, 0), source);
     sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
-    HYBRID_BFS.parent[source] = source;
+    HYBRID_BFS.parent[source] = hybrid_bfs_encode_parent(source);
 
     long edges_to_check = G.num_edges * 2;
     mw_replicated_init(&HYBRID_BFS.scout_count, G.vertex_out_degree[source]);
+    // False after bottom-up steps, which don't compute the scout count
+    bool scout_count_valid = true;
 
     // While there are vertices in the queue...
     while (!sliding_queue_all_empty(&HYBRID_BFS.queue)) {
-        if (HYBRID_BFS.scout_count > edges_to_check / alpha) {
+        if (switch_to_bottom_up(HYBRID_BFS.scout_count, edges_to_check, alpha)) {
             long awake_count, old_awake_count;
             awake_count = sliding_queue_combined_size(&HYBRID_BFS.queue);
+            long switch_edges = edges_to_check;
             // Do bottom-up steps for a while
             do {
                 old_awake_count = awake_count;
-                // hooks_set_attr_i64("awake_count", awake_count);
-                // hooks_region_begin("bottom_up_step");
+                trace_step_begin(BOTTOM_UP);
+                double start_ms = cost_model_timestamp();
                 awake_count = bottom_up_step();
+                // Only the first step after the switch is predicted by the cost model
+                cost_model_add_bottom_up(start_ms, switch_edges);
+                switch_edges = 0;
+                trace_step_end();
+                sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
+            } while (awake_count >= old_awake_count ||
+                    (awake_count > G.num_vertices / beta));
+            mw_replicated_init(&HYBRID_BFS.scout_count, 1);
+            scout_count_valid = false;
+        } else {
+            long frontier_edges = scout_count_valid ? HYBRID_BFS.scout_count : 0;
+            edges_to_check -= HYBRID_BFS.scout_count;
+            // Do a top-down step
+            trace_step_begin(TOP_DOWN_MIGRATING_THREADS);
+            double start_ms = cost_model_timestamp();
+            top_down_step_with_migrating_threads();
+            cost_model_add_top_down(start_ms, frontier_edges);
+            scout_count_valid = true;
+            trace_step_end();
+            // Slide all queues to explore the next frontier
+            sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
+        }
+    }
+}
+
+/**
+ * Run BFS using Scott Beamer's direction-optimizing algorithm,
+ * with a replicated frontier bitmap for the bottom-up steps
+ *  1. Do top-down steps with migrating threads until condition is met
+ *  2. Do bottom-up steps with the frontier bitmap until condition is met
+ *  3. Do top-down steps with migrating threads until done
+ */
+void
+hybrid_bfs_run_beamer_with_bitmap(long source, long alpha, long beta)
+{
+    assert(source < G.num_vertices);
+
+    // Start with the source vertex in the first frontier, at level 0, and mark it as visited
+    sliding_queue_push_back(get_nth(&HYBRID_BFS.queue, 0), source);
+    sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
+    HYBRID_BFS.parent[source] = hybrid_bfs_encode_parent(source);
+
+    long edges_to_check = G.num_edges * 2;
+    mw_replicated_init(&HYBRID_BFS.scout_count, G.vertex_out_degree[source]);
+    // False after bottom-up steps, which don't compute the scout count
+    bool scout_count_valid = true;
+
+    // While there are vertices in the queue...
+    while (!sliding_queue_all_empty(&HYBRID_BFS.queue)) {
+        if (switch_to_bottom_up(HYBRID_BFS.scout_count, edges_to_check, alpha)) {
+            long awake_count, old_awake_count;
+            awake_count = sliding_queue_combined_size(&HYBRID_BFS.queue);
+            long switch_edges = edges_to_check;
+            // Switching to bottom-up, convert the queue into a bitmap
+            frontier_bitmap_from_queue();
+            // Do bottom-up steps for a while
+            do {
+                old_awake_count = awake_count;
+                trace_step_begin(BOTTOM_UP_BITMAP);
+                double start_ms = cost_model_timestamp();
+                awake_count = bottom_up_step_with_bitmap();
+                // Only the first step after the switch is predicted by the cost model
+                cost_model_add_bottom_up(start_ms, switch_edges);
+                switch_edges = 0;
+                trace_step_end();
                 sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
-                // hooks_region_end();
             } while (awake_count >= old_awake_count ||
                     (awake_count > G.num_vertices / beta));
             mw_replicated_init(&HYBRID_BFS.scout_count, 1);
+            scout_count_valid = false;
         } else {
+            long frontier_edges = scout_count_valid ? HYBRID_BFS.scout_count : 0;
             edges_to_check -= HYBRID_BFS.scout_count;
             // Do a top-down step
-            // hooks_region_begin("top_down_step");
+            trace_step_begin(TOP_DOWN_MIGRATING_THREADS);
+            double start_ms = cost_model_timestamp();
             top_down_step_with_migrating_threads();
+            cost_model_add_top_down(start_ms, frontier_edges);
+            scout_count_valid = true;
+            trace_step_end();
             // Slide all queues to explore the next frontier
             sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
-            // hooks_region_end();
         }
-        // dump_queue_stats();
     }
 }
 
@@ -550,12 +1311,15 @@ hybrid_bfs_run_with_migrating_threads(long source)
     // Start with the source vertex in the first frontier, at level 0, and mark it as visited
     sliding_queue_push_back(get_nth(&HYBRID_BFS.queue, 0), source);
     sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
-    HYBRID_BFS.parent[source] = source;
+    HYBRID_BFS.parent[source] = hybrid_bfs_encode_parent(source);
+    mw_replicated_init(&HYBRID_BFS.scout_count, G.vertex_out_degree[source]);
 
     // While there are vertices in the queue...
     while (!sliding_queue_all_empty(&HYBRID_BFS.queue)) {
         // Explore the frontier
+        trace_step_begin(TOP_DOWN_MIGRATING_THREADS);
         top_down_step_with_migrating_threads();
+        trace_step_end();
         // Slide all queues to explore the next frontier
         sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
     }
@@ -572,12 +1336,15 @@ hybrid_bfs_run_with_remote_writes(long source)
     // Start with the source vertex in the first frontier, at level 0, and mark it as visited
     sliding_queue_push_back(get_nth(&HYBRID_BFS.queue, 0), source);
     sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
-    HYBRID_BFS.parent[source] = source;
+    HYBRID_BFS.parent[source] = hybrid_bfs_encode_parent(source);
+    mw_replicated_init(&HYBRID_BFS.scout_count, G.vertex_out_degree[source]);
 
     // While there are vertices in the queue...
     while (!sliding_queue_all_empty(&HYBRID_BFS.queue)) {
         // Explore the frontier
+        trace_step_begin(TOP_DOWN_REMOTE_WRITES);
         top_down_step_with_remote_writes();
+        trace_step_end();
         // Slide all queues to explore the next frontier
         sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
     }
@@ -597,7 +1364,7 @@ hybrid_bfs_run_with_remote_writes_hybrid(long source, long alpha, long beta)
     // Start with the source vertex in the first frontier, at level 0, and mark it as visited
     sliding_queue_push_back(get_nth(&HYBRID_BFS.queue, 0), source);
     sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
-    HYBRID_BFS.parent[source] = source;
+    HYBRID_BFS.parent[source] = hybrid_bfs_encode_parent(source);
 
     long edges_to_check = G.num_edges * 2;
     mw_replicated_init(&HYBRID_BFS.scout_count, G.vertex_out_degree[source]);
@@ -611,7 +1378,9 @@ hybrid_bfs_run_with_remote_writes_hybrid(long source, long alpha, long beta)
             // Do remote-write steps for a while
             do {
                 old_awake_count = awake_count;
+                trace_step_begin(TOP_DOWN_REMOTE_WRITES);
                 top_down_step_with_remote_writes();
+                trace_step_end();
                 sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
                 awake_count = sliding_queue_combined_size(&HYBRID_BFS.queue);
             } while (awake_count >= old_awake_count ||
@@ -619,7 +1388,9 @@ hybrid_bfs_run_with_remote_writes_hybrid(long source, long alpha, long beta)
             mw_replicated_init(&HYBRID_BFS.scout_count, 1);
         } else {
             edges_to_check -= HYBRID_BFS.scout_count;
+            trace_step_begin(TOP_DOWN_MIGRATING_THREADS);
             top_down_step_with_migrating_threads();
+            trace_step_end();
             // Slide all queues to explore the next frontier
             sliding_queue_slide_all_windows(&HYBRID_BFS.queue);
         }
@@ -636,6 +1407,7 @@ hybrid_bfs_run_with_remote_writes_hybrid(long source, long alpha, long beta)
 void
 hybrid_bfs_run(hybrid_bfs_alg alg, long source, long alpha, long beta)
 {
+    trace_search_begin(source);
     if (alg == REMOTE_WRITES) {
         hybrid_bfs_run_with_remote_writes(source);
     } else if (alg == MIGRATING_THREADS) {
@@ -644,110 +1416,161 @@ hybrid_bfs_run(hybrid_bfs_alg alg, long source, long alpha, long beta)
         hybrid_bfs_run_with_remote_writes_hybrid(source, alpha, beta);
     } else if (alg == BEAMER_HYBRID) {
         hybrid_bfs_run_beamer(source, alpha, beta);
+    } else if (alg == BEAMER_HYBRID_BITMAP) {
+        hybrid_bfs_run_beamer_with_bitmap(source, alpha, beta);
     } else {
         assert(0);
     }
+    trace_search_end();
 }
 
-bool
-hybrid_bfs_check(long source)
+/**
+ * Validate the BFS tree using the five rules from the Graph500 specification:
+ *  1. The parent pointers form a tree rooted at the source vertex (no cycles)
+ *  2. Each tree edge connects vertices whose depths differ by exactly one
+ *  3. Every edge in the graph connects vertices whose depths differ by at most one,
+ *     or vertices that are both outside the tree
+ *  4. The tree spans an entire connected component: no edge connects
+ *     a vertex in the tree to a vertex outside of it
+ *  5. Each vertex and its parent are joined by an edge in the graph
+ *
+ * Depths are reconstructed from the parent pointers one level at a time,
+ * into a striped array. Then each vertex checks its own edges in parallel.
+ *
+ * Overview of hybrid_bfs_check()
+ *   spawn init_depth_worker() over the entire vertex list
+ *   FOR each level
+ *     spawn compute_depth_worker() over the entire vertex list
+ *   spawn check_vertex_worker() over the entire vertex list
+ */
+
+// Indices into the array of error counters
+enum {
+    ERR_NOT_A_TREE,
+    ERR_TREE_EDGE_DEPTH,
+    ERR_EDGE_SPANS_LEVELS,
+    ERR_NOT_SPANNING,
+    ERR_MISSING_TREE_EDGE,
+    NUM_VALIDATION_RULES
+};
+
+static const char * validation_rule_names[NUM_VALIDATION_RULES] = {
+    "parent pointers do not form a tree rooted at the source",
+    "tree edge does not connect adjacent levels",
+    "graph edge spans more than one level",
+    "graph edge connects a vertex in the tree to a vertex outside it",
+    "tree edge does not exist in the graph",
+};
+
+static void
+init_depth_worker(long * depth, long begin, long end, va_list args)
 {
-    // Local array to store the depth of each vertex in the tree
-    long * depth = mw_localmalloc(G.num_vertices * sizeof(long), &depth);
-    assert(depth);
-    for (long i = 0; i < G.num_vertices; ++i) { depth[i] = -1; }
+    for (long v = begin; v < end; v += NODELETS()) {
+        depth[v] = -1;
+    }
+}
 
-    // Do a serial BFS
-    cursor c;
-    sliding_queue q;
-    sliding_queue_init(&q, G.num_vertices);
-    // Push source into the queue
-    sliding_queue_push_back(&q, source);
-    sliding_queue_slide_window(&q);
-    depth[source] = 0;
-    // For each vertex in the queue...
-    for (long i = q.start; i < q.end; ++i) {
-        long u = q.buffer[i];
-        // For each out-neighbor of this vertex...
-        for (cursor_init_out(&c, u); cursor_valid(&c); cursor_next(&c)) {
-            long v = *c.e;
-            // Add unexplored neighbors to the queue
-            if (depth[v] == -1) {
-                depth[v] = depth[u] + 1;
-                sliding_queue_push_back(&q, v);
-            }
+// Assign a depth to every vertex whose parent is at the previous level
+static void
+compute_depth_worker(long * depth, long begin, long end, va_list args)
+{
+    long current_depth = va_arg(args, long);
+    long * num_assigned = va_arg(args, long*);
+    long local_num_assigned = 0;
+    for (long v = begin; v < end; v += NODELETS()) {
+        if (depth[v] >= 0) { continue; }
+        long parent = hybrid_bfs_get_parent(v);
+        if (parent < 0 || parent >= G.num_vertices) { continue; }
+        if (depth[parent] == current_depth - 1) {
+            depth[v] = current_depth;
+            local_num_assigned += 1;
         }
-        sliding_queue_slide_window(&q);
-    }
-
-    // // Dump the tree to stdout
-    // // For each level in the tree...
-    // bool is_level_empty = false;
-    // for (long current_depth = 0; !is_level_empty; ++current_depth) {
-    //     is_level_empty = true;
-    //     printf("Level %li:", current_depth);
-    //     for (long v = 0; v < G.num_vertices; ++v) {
-    //         // Print every vertex at this depth in the tree
-    //         if (depth[v] == current_depth) {
-    //             printf(" %li", v);
-    //             // Keep going as long as we find a vertex at each level
-    //             is_level_empty = false;
-    //         }
-    //     }
-    //     printf("\n");
-    // }
-    // fflush(stdout);
-
-    // Check each vertex
-    // We are comparing the parent array produced by the parallel BFS
-    // with the depth array produced by the serial BFS
-    bool correct = true;
-    long * parent = HYBRID_BFS.parent;
-    for (long u = 0; u < G.num_vertices; ++u) {
-        // Is the vertex a part of both BFS trees?
-        if (depth[u] >= 0 && parent[u] >= 0) {
-
-            // Special case for source vertex
-            if (u == source) {
-                if (!((parent[u] == u) && (depth[u] == 0))) {
-                    LOG("Source wrong\n");
-                    correct = false;
-                    break;
-                }
-                continue;
-            }
+    }
+    REMOTE_ADD(num_assigned, local_num_assigned);
+}
 
-            // Verify that this vertex is connected to its parent
-            bool parent_found = false;
-            // For all in-edges...
-            for (cursor_init_out(&c, u); cursor_valid(&c); cursor_next(&c)) {
-                long v = *c.e;
-                // If v is the parent of u, their depths should differ by 1
-                if (v == parent[u]) {
-                    if (depth[v] != depth[u] - 1) {
-                        LOG("Wrong depths for %li and %li\n", u, v);
-                        break;
-                    }
-                    parent_found = true;
-                    break;
-                }
+static void
+check_vertex_worker(long * depth, long begin, long end, va_list args)
+{
+    long source = va_arg(args, long);
+    long * errors = va_arg(args, long*);
+    long local_errors[NUM_VALIDATION_RULES] = {0};
+    cursor c;
+    for (long v = begin; v < end; v += NODELETS()) {
+        long parent = hybrid_bfs_get_parent(v);
+        long depth_v = depth[v];
+        // Every vertex in the tree must be connected back to the source
+        if (parent >= 0 && (parent >= G.num_vertices || depth_v < 0)) {
+            local_errors[ERR_NOT_A_TREE] += 1;
+            continue;
+        }
+        if (parent >= 0 && v != source) {
+            if (depth_v != depth[parent] + 1) {
+                local_errors[ERR_TREE_EDGE_DEPTH] += 1;
             }
-            if (!parent_found) {
-                LOG("Couldn't find edge from %li to %li\n", parent[u], u);
-                correct = false;
-                break;
+        }
+        bool parent_found = parent < 0 || v == source;
+        // For each out-neighbor of this vertex...
+        for (cursor_init_out(&c, v); cursor_valid(&c); cursor_next(&c)) {
+            long u = cursor_get(&c);
+            if (u == parent) { parent_found = true; }
+            long depth_u = depth[u];
+            if ((depth_v < 0) != (depth_u < 0)) {
+                local_errors[ERR_NOT_SPANNING] += 1;
+            } else if (depth_v >= 0 && labs(depth_v - depth_u) > 1) {
+                local_errors[ERR_EDGE_SPANS_LEVELS] += 1;
             }
-        // Do both trees agree about whether this vertex is in the tree?
-        } else if ((depth[u] < 0) != (parent[u] < 0)) {
-            LOG("Reachability mismatch: depth[%li] = %li, parent[%li] = %li\n",
-                u, depth[u], u, parent[u]);
-            correct = false;
-            break;
         }
+        if (!parent_found) {
+            local_errors[ERR_MISSING_TREE_EDGE] += 1;
+        }
+    }
+    for (long i = 0; i < NUM_VALIDATION_RULES; ++i) {
+        if (local_errors[i]) {
+            REMOTE_ADD(&errors[i], local_errors[i]);
+        }
+    }
+}
+
+bool
+hybrid_bfs_check(long source)
+{
+    // The source must be the root of the tree
+    if (hybrid_bfs_get_parent(source) != source) {
+        LOG("Source wrong\n");
+        return false;
     }
 
-    sliding_queue_deinit(&q);
+    // Striped array to store the depth of each vertex in the tree
+    long * depth = mw_malloc1dlong(G.num_vertices);
+    assert(depth);
+    long grain = GLOBAL_GRAIN_MIN(G.num_vertices, 128);
+    emu_1d_array_apply(depth, G.num_vertices, grain, init_depth_worker);
+    depth[source] = 0;
+
+    // Assign depths one level at a time, until no more vertices can be reached
+    for (long current_depth = 1; ; ++current_depth) {
+        long num_assigned = 0;
+        emu_1d_array_apply(depth, G.num_vertices, grain,
+            compute_depth_worker, current_depth, &num_assigned
+        );
+        if (num_assigned == 0) { break; }
+    }
+
+    // Check all the rules in parallel
+    long errors[NUM_VALIDATION_RULES] = {0};
+    emu_1d_array_apply(depth, G.num_vertices, grain,
+        check_vertex_worker, source, errors
+    );
     mw_free(depth);
+
+    bool correct = true;
+    for (long i = 0; i < NUM_VALIDATION_RULES; ++i) {
+        if (errors[i]) {
+            LOG("Rule %li failed %li times: %s\n", i + 1, errors[i], validation_rule_names[i]);
+            correct = false;
+        }
+    }
     return correct;
 }
 
@@ -755,7 +1578,7 @@ void
 hybrid_bfs_print_tree()
 {
     for (long v = 0; v < G.num_vertices; ++v) {
-        long parent = HYBRID_BFS.parent[v];
+        long parent = hybrid_bfs_get_parent(v);
         if (parent < 0) { continue; }
 
         printf("%4li", v);
@@ -763,8 +1586,8 @@ hybrid_bfs_print_tree()
         while(true) {
             LOG(" <- %4li", parent);
             if (parent == -1) { break; }
-            if (parent == HYBRID_BFS.parent[parent]) { break; }
-            parent = HYBRID_BFS.parent[parent];
+            if (parent == hybrid_bfs_get_parent(parent)) { break; }
+            parent = hybrid_bfs_get_parent(parent);
         }
         printf("\n");
     }
@@ -777,7 +1600,7 @@ compute_num_traversed_edges_worker(long * array, long begin, long end, long * pa
     long local_sum = 0;
     const long nodelets = NODELETS();
     for (long v = begin; v < end; v += nodelets) {
-        if (HYBRID_BFS.parent[v] >= 0) {
+        if (hybrid_bfs_is_visited(HYBRID_BFS.parent[v])) {
             local_sum += G.vertex_out_degree[v];
         }
     }
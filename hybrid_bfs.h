@@ -2,28 +2,105 @@
 
 #include "graph.h"
 #include "sliding_queue.h"
+#include "bitmap.h"
 
 typedef struct hybrid_bfs_data {
     // Tracks the sum of the degrees of vertices in the frontier
     long scout_count;
-    // For each vertex, parent in the BFS tree.
+    // Number of edges examined by the current step (used for tracing)
+    long edges_examined;
+    // Nonzero if per-level tracing is enabled, so the workers should count edges
+    long trace_enabled;
+    // Incremented at the start of each search
+    long epoch;
+    // For each vertex, parent in the BFS tree, tagged with the epoch of the search
+    // Use hybrid_bfs_get_parent() to decode
     long * parent;
-    // Temporary copy of parent array
+    // Temporary copy of parent array, tagged the same way
     long * new_parent;
+    // Bitmap of vertices that were assigned a new_parent during a remote-writes step
+    // Word i only holds bits for vertices on nodelet (i % NODELETS()),
+    // so it is always colocated with the vertices it tracks
+    unsigned long * touched;
+    // Length of the touched array
+    long num_touched_words;
     // Used to store vertices to visit in the next frontier
     sliding_queue queue;
+    // Vertices in the current frontier, replicated so bottom-up steps can check locally
+    bitmap frontier;
+    // Vertices added to the frontier during the current bottom-up step
+    bitmap next_frontier;
 } hybrid_bfs_data;
 
 // Global replicated struct with BFS data pointers
 extern replicated hybrid_bfs_data HYBRID_BFS;
 
+// Parent pointers are stored as (epoch << HYBRID_BFS_EPOCH_SHIFT | parent).
+// Entries with an old epoch were written by a previous search, and are treated
+// as unvisited. So there is no need to clear the parent array between searches.
+#define HYBRID_BFS_EPOCH_SHIFT 44
+#define HYBRID_BFS_MAX_EPOCH ((1L << (63 - HYBRID_BFS_EPOCH_SHIFT)) - 1)
+
+static inline long
+hybrid_bfs_encode_parent(long parent)
+{
+    return (HYBRID_BFS.epoch << HYBRID_BFS_EPOCH_SHIFT) | parent;
+}
+
+// Was this entry written during the current search?
+static inline bool
+hybrid_bfs_is_visited(long encoded_parent)
+{
+    return (encoded_parent >> HYBRID_BFS_EPOCH_SHIFT) == HYBRID_BFS.epoch;
+}
+
+// Returns the parent of v in the current BFS tree, or -1 if v was not reached
+static inline long
+hybrid_bfs_get_parent(long v)
+{
+    long encoded_parent = HYBRID_BFS.parent[v];
+    if (!hybrid_bfs_is_visited(encoded_parent)) { return -1; }
+    return encoded_parent & ((1L << HYBRID_BFS_EPOCH_SHIFT) - 1);
+}
+
 typedef enum hybrid_bfs_alg {
     REMOTE_WRITES,
     MIGRATING_THREADS,
     REMOTE_WRITES_HYBRID,
     BEAMER_HYBRID,
+    BEAMER_HYBRID_BITMAP,
 } hybrid_bfs_alg;
 
+typedef enum hybrid_bfs_step_type {
+    TOP_DOWN_MIGRATING_THREADS,
+    TOP_DOWN_REMOTE_WRITES,
+    BOTTOM_UP,
+    BOTTOM_UP_BITMAP,
+} hybrid_bfs_step_type;
+
+// Statistics for a single level of a search, recorded when tracing is enabled
+typedef struct hybrid_bfs_level_trace {
+    // Index of the search, counting from zero
+    long search;
+    // Source vertex of the search
+    long source;
+    // Depth of the frontier in the BFS tree
+    long level;
+    // Which kind of step was used to explore this level
+    hybrid_bfs_step_type step;
+    // Sum of the degrees of the vertices in the frontier, as estimated by the hybrid heuristic
+    long scout_count;
+    // Number of vertices added to the next frontier
+    long awake_count;
+    // Top-down: out-degree of all vertices in the frontier
+    // Bottom-up: edges checked before each unvisited vertex found a parent
+    long edges_examined;
+    // Time spent in the step
+    double time_ms;
+    // Number of vertices in the frontier on each nodelet
+    long * frontier_size;
+} hybrid_bfs_level_trace;
+
 void hybrid_bfs_init();
 void hybrid_bfs_run(hybrid_bfs_alg alg, long source, long alpha, long beta);
 long hybrid_bfs_count_num_traversed_edges();
@@ -31,4 +108,8 @@ bool hybrid_bfs_check(long source);
 void hybrid_bfs_print_tree();
 void hybrid_bfs_data_clear();
 void hybrid_bfs_deinit();
+void hybrid_bfs_trace_enable();
+void hybrid_bfs_trace_write_csv(FILE * fp);
+void hybrid_bfs_trace_deinit();
+void hybrid_bfs_cost_model_enable();
 
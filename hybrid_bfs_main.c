@@ -1,10 +1,16 @@
 #include <string.h>
 #include <getopt.h>
 #include <limits.h>
+#include <assert.h>
 
 #include "load_edge_list.h"
 #include "graph_from_edge_list.h"
+#include "graph_snapshot.h"
+#include "relabel.h"
+#include "dynamic_graph.h"
+#include "compressed_graph.h"
 #include "hybrid_bfs.h"
+#include "graph500_stats.h"
 
 #define LCG_MUL64 6364136223846793005ULL
 #define LCG_ADD64 1
@@ -39,17 +45,29 @@ lcg_rand(unsigned long * x) {
 const struct option long_options[] = {
     {"graph_filename"   , required_argument},
     {"distributed_load" , no_argument},
+    {"save_graph"       , required_argument},
+    {"load_graph"       , required_argument},
+    {"sort_construction", no_argument},
+    {"relabel"          , no_argument},
+    {"insert_edges"     , required_argument},
+    {"delete_edges"     , required_argument},
     {"heavy_threshold"  , required_argument},
     {"num_trials"       , required_argument},
     {"source_vertex"    , required_argument},
     {"algorithm"        , required_argument},
     {"alpha"            , required_argument},
     {"beta"             , required_argument},
+    {"autotune"         , no_argument},
+    {"autotune_samples" , required_argument},
+    {"cost_model"       , no_argument},
     {"sort_edge_blocks" , no_argument},
+    {"compress"         , no_argument},
     {"dump_edge_list"   , no_argument},
     {"check_graph"      , no_argument},
     {"dump_graph"       , no_argument},
     {"check_results"    , no_argument},
+    {"trace_file"       , required_argument},
+    {"stats_file"       , required_argument},
     {"help"             , no_argument},
     {NULL}
 };
@@ -60,34 +78,62 @@ print_help(const char* argv0)
     LOG( "Usage: %s [OPTIONS]\n", argv0);
     LOG("\t--graph_filename     Path to graph file to load\n");
     LOG("\t--distributed_load   Load the graph from all nodes at once (File must exist on all nodes, use absolute path).\n");
+    LOG("\t--save_graph         Save the constructed graph to this file\n");
+    LOG("\t--load_graph         Load a graph saved with --save_graph, instead of constructing it from --graph_filename\n");
+    LOG("\t--sort_construction  Construct the graph by sorting edges on each nodelet, instead of with remote atomics\n");
+    LOG("\t--relabel            Renumber vertices so that neighbors are more likely to be on the same nodelet\n");
+    LOG("\t--insert_edges       After constructing the graph, insert the edges from this file\n");
+    LOG("\t--delete_edges       After constructing the graph, delete the edges from this file\n");
     LOG("\t--heavy_threshold    Vertices with this many neighbors will be spread across nodelets\n");
     LOG("\t--num_trials         Run BFS this many times.\n");
     LOG("\t--source_vertex      Use this as the source vertex. If unspecified, pick random vertices.\n");
     LOG("\t--algorithm          Select BFS implementation to run\n");
     LOG("\t--alpha              Alpha parameter for direction-optimizing BFS\n");
     LOG("\t--beta               Beta parameter for direction-optimizing BFS\n");
+    LOG("\t--autotune           Search for the best alpha and beta for this graph and algorithm, and save them next to the graph file.\n");
+    LOG("\t                     Later runs load the saved values unless --alpha or --beta is given.\n");
+    LOG("\t--autotune_samples   Number of source vertices to time each alpha/beta pair with during --autotune\n");
+    LOG("\t--cost_model         Switch to bottom-up based on measured per-edge costs instead of alpha\n");
     LOG("\t--sort_edge_blocks   Sort edge blocks to group neighbors by home nodelet.\n");
+    LOG("\t--compress           Store edges as delta-encoded varints to save memory\n");
     LOG("\t--dump_edge_list     Print the edge list to stdout after loading (slow)\n");
     LOG("\t--check_graph        Validate the constructed graph against the edge list (slow)\n");
     LOG("\t--dump_graph         Print the graph to stdout after construction (slow)\n");
-    LOG("\t--check_results      Validate the BFS results (slow)\n");
+    LOG("\t--check_results      Validate the BFS tree with the Graph500 rules\n");
+    LOG("\t--trace_file         Record statistics for each level of each search, and write them to this file in CSV format\n");
+    LOG("\t--stats_file         Write Graph500 statistics over all trials to this file in JSON format\n");
     LOG("\t--help               Print command line help\n");
 }
 
 typedef struct bfs_args {
     const char* graph_filename;
     bool distributed_load;
+    const char* save_graph;
+    const char* load_graph;
+    bool sort_construction;
+    bool relabel;
+    const char* insert_edges;
+    const char* delete_edges;
     long heavy_threshold;
     long num_trials;
     long source_vertex;
     const char* algorithm;
     long alpha;
     long beta;
+    // Set if alpha or beta was given on the command line
+    bool alpha_set;
+    bool beta_set;
+    bool autotune;
+    long autotune_samples;
+    bool cost_model;
     bool sort_edge_blocks;
+    bool compress;
     bool dump_edge_list;
     bool check_graph;
     bool dump_graph;
     bool check_results;
+    const char* trace_file;
+    const char* stats_file;
 } bfs_args;
 
 struct bfs_args
@@ -96,17 +142,32 @@ parse_args(int argc, char *argv[])
     bfs_args args;
     args.graph_filename = NULL;
     args.distributed_load = false;
+    args.save_graph = NULL;
+    args.load_graph = NULL;
+    args.sort_construction = false;
+    args.relabel = false;
+    args.insert_edges = NULL;
+    args.delete_edges = NULL;
     args.heavy_threshold = LONG_MAX;
     args.num_trials = 1;
     args.source_vertex = -1;
     args.algorithm = "remote_writes_hybrid";
-    args.alpha = 15;
-    args.beta = 18;
+    // Unless set, use the saved tuning result, or the default
+    args.alpha = 0;
+    args.beta = 0;
+    args.alpha_set = false;
+    args.beta_set = false;
+    args.autotune = false;
+    args.autotune_samples = 4;
+    args.cost_model = false;
     args.sort_edge_blocks = false;
+    args.compress = false;
     args.dump_edge_list = false;
     args.check_graph = false;
     args.dump_graph = false;
     args.check_results = false;
+    args.trace_file = NULL;
+    args.stats_file = NULL;
 
     int option_index;
     while (true)
@@ -126,6 +187,18 @@ parse_args(int argc, char *argv[])
             args.graph_filename = optarg;
         } else if (!strcmp(option_name, "distributed_load")) {
             args.distributed_load = true;
+        } else if (!strcmp(option_name, "save_graph")) {
+            args.save_graph = optarg;
+        } else if (!strcmp(option_name, "load_graph")) {
+            args.load_graph = optarg;
+        } else if (!strcmp(option_name, "sort_construction")) {
+            args.sort_construction = true;
+        } else if (!strcmp(option_name, "relabel")) {
+            args.relabel = true;
+        } else if (!strcmp(option_name, "insert_edges")) {
+            args.insert_edges = optarg;
+        } else if (!strcmp(option_name, "delete_edges")) {
+            args.delete_edges = optarg;
         } else if (!strcmp(option_name, "heavy_threshold")) {
             args.heavy_threshold = atol(optarg);
         } else if (!strcmp(option_name, "num_trials")) {
@@ -136,10 +209,20 @@ parse_args(int argc, char *argv[])
             args.algorithm = optarg;
         } else if (!strcmp(option_name, "alpha")) {
             args.alpha = atol(optarg);
+            args.alpha_set = true;
         } else if (!strcmp(option_name, "beta")) {
             args.beta = atol(optarg);
+            args.beta_set = true;
+        } else if (!strcmp(option_name, "autotune")) {
+            args.autotune = true;
+        } else if (!strcmp(option_name, "autotune_samples")) {
+            args.autotune_samples = atol(optarg);
+        } else if (!strcmp(option_name, "cost_model")) {
+            args.cost_model = true;
         } else if (!strcmp(option_name, "sort_edge_blocks")) {
             args.sort_edge_blocks = true;
+        } else if (!strcmp(option_name, "compress")) {
+            args.compress = true;
         } else if (!strcmp(option_name, "dump_edge_list")) {
             args.dump_edge_list = true;
         } else if (!strcmp(option_name, "check_graph")) {
@@ -148,16 +231,60 @@ parse_args(int argc, char *argv[])
             args.dump_graph = true;
         } else if (!strcmp(option_name, "check_results")) {
             args.check_results = true;
+        } else if (!strcmp(option_name, "trace_file")) {
+            args.trace_file = optarg;
+        } else if (!strcmp(option_name, "stats_file")) {
+            args.stats_file = optarg;
         } else if (!strcmp(option_name, "help")) {
             print_help(argv[0]);
             exit(1);
         }
     }
+    if (args.load_graph != NULL) {
+        // There is no edge list when loading a saved graph
+        if (args.dump_edge_list || args.check_graph) {
+            LOG( "dump_edge_list and check_graph can't be used with load_graph\n"); exit(1);
+        }
+        if (args.relabel) {
+            LOG( "relabel can't be used with load_graph\n"); exit(1);
+        }
+        // Tuning results are still saved next to the graph file
+        if (args.graph_filename == NULL) { args.graph_filename = args.load_graph; }
+    }
     if (args.graph_filename == NULL) { LOG( "Missing graph filename\n"); exit(1); }
+    if (args.insert_edges || args.delete_edges) {
+        // Update files use the vertex ID's of the input file, and replace the edge list
+        if (args.relabel || args.check_graph) {
+            LOG( "relabel and check_graph can't be used with insert_edges or delete_edges\n"); exit(1);
+        }
+    }
     if (args.heavy_threshold <= 0) { LOG( "heavy_threshold must be > 0\n"); exit(1); }
+    if (args.sort_construction && args.heavy_threshold != LONG_MAX) {
+        LOG( "heavy_threshold can't be used with sort_construction\n"); exit(1);
+    }
+    // Snapshots store each edge block as a local array
+    if (args.save_graph && args.heavy_threshold != LONG_MAX) {
+        LOG( "heavy_threshold can't be used with save_graph\n"); exit(1);
+    }
+    // Snapshots don't store the mapping back to the vertex ID's in the input file
+    if (args.save_graph && args.relabel) {
+        LOG( "relabel can't be used with save_graph\n"); exit(1);
+    }
+    if (args.compress) {
+        // Compressed edges must be sorted by vertex ID
+        if (args.sort_edge_blocks || args.heavy_threshold != LONG_MAX) {
+            LOG( "sort_edge_blocks and heavy_threshold can't be used with compress\n"); exit(1);
+        }
+        // Edge blocks that were grown by updates are not tracked after compression
+        if (args.insert_edges || args.delete_edges) {
+            LOG( "insert_edges and delete_edges can't be used with compress\n"); exit(1);
+        }
+    }
     if (args.num_trials <= 0) { LOG( "num_trials must be > 0\n"); exit(1); }
-    if (args.alpha <= 0) { LOG( "alpha must be > 0\n"); exit(1); }
-    if (args.beta <= 0) { LOG( "beta must be > 0\n"); exit(1); }
+    // Both are used as divisors when choosing the direction of each step
+    if (args.alpha_set && args.alpha <= 0) { LOG( "alpha must be > 0\n"); exit(1); }
+    if (args.beta_set && args.beta <= 0) { LOG( "beta must be > 0\n"); exit(1); }
+    if (args.autotune_samples <= 0) { LOG( "autotune_samples must be > 0\n"); exit(1); }
     return args;
 }
 
@@ -166,11 +293,99 @@ pick_random_vertex()
 {
     long source;
     do {
-        source = lcg_rand(&lcg_state) % G.num_vertices;
+        // Pick from the original vertex ID's, so relabeling doesn't change the sequence of sources
+        source = relabel_get_new_id(lcg_rand(&lcg_state) % G.num_vertices);
     } while (G.vertex_out_degree[source] == 0);
     return source;
 }
 
+// Only the hybrid algorithms use alpha and beta
+bool
+uses_alpha_beta(hybrid_bfs_alg alg)
+{
+    return alg == REMOTE_WRITES_HYBRID
+        || alg == BEAMER_HYBRID
+        || alg == BEAMER_HYBRID_BITMAP;
+}
+
+// Tuning results are saved as "<graph_filename>.<algorithm>.tune"
+void
+get_tune_filename(char * buffer, size_t size, const char * graph_filename, const char * algorithm)
+{
+    snprintf(buffer, size, "%s.%s.tune", graph_filename, algorithm);
+}
+
+// Load alpha and beta from a tuning file. Returns false if the file doesn't exist or is invalid
+bool
+load_tuning(const char * filename, long * alpha, long * beta)
+{
+    FILE * fp = fopen(filename, "r");
+    if (fp == NULL) { return false; }
+    long a, b;
+    int rc = fscanf(fp, "alpha %li beta %li", &a, &b);
+    fclose(fp);
+    if (rc != 2 || a <= 0 || b <= 0) {
+        LOG("Ignoring invalid tuning file %s\n", filename);
+        return false;
+    }
+    *alpha = a;
+    *beta = b;
+    return true;
+}
+
+void
+save_tuning(const char * filename, long alpha, long beta)
+{
+    FILE * fp = fopen(filename, "w");
+    if (fp == NULL) {
+        LOG("Unable to save tuning results to %s\n", filename);
+        return;
+    }
+    fprintf(fp, "alpha %li\nbeta %li\n", alpha, beta);
+    fclose(fp);
+}
+
+/**
+ * Search for the alpha and beta parameters that minimize the mean search time.
+ * Every alpha/beta pair on the grid is timed on the same sample of source vertices.
+ */
+void
+autotune(hybrid_bfs_alg alg, long num_samples, long * best_alpha, long * best_beta)
+{
+    static const long alphas[] = {2, 4, 8, 15, 30, 60, 120};
+    static const long betas[] = {6, 12, 18, 24, 48, 96};
+    const long num_alphas = sizeof(alphas) / sizeof(alphas[0]);
+    const long num_betas = sizeof(betas) / sizeof(betas[0]);
+
+    long * sources = malloc(num_samples * sizeof(long));
+    assert(sources);
+    for (long s = 0; s < num_samples; ++s) {
+        sources[s] = pick_random_vertex();
+    }
+
+    double best_time_ms = -1;
+    for (long a = 0; a < num_alphas; ++a) {
+        for (long b = 0; b < num_betas; ++b) {
+            double time_ms = 0;
+            for (long s = 0; s < num_samples; ++s) {
+                hybrid_bfs_data_clear();
+                double start_ms = timestamp_ms();
+                hybrid_bfs_run(alg, sources[s], alphas[a], betas[b]);
+                time_ms += timestamp_ms() - start_ms;
+            }
+            time_ms /= num_samples;
+            LOG("alpha = %li, beta = %li: %3.2f ms\n", alphas[a], betas[b], time_ms);
+            if (best_time_ms < 0 || time_ms < best_time_ms) {
+                best_time_ms = time_ms;
+                *best_alpha = alphas[a];
+                *best_beta = betas[b];
+            }
+        }
+    }
+    hybrid_bfs_data_clear();
+    free(sources);
+}
+
 int main(int argc, char ** argv)
 {
     // Set active region for hooks
@@ -185,23 +400,78 @@ int main(int argc, char ** argv)
     bfs_args args = parse_args(argc, argv);
     hooks_set_attr_i64("heavy_threshold", args.heavy_threshold);
 
-    // Load the edge list
-    if (args.distributed_load) {
-        load_edge_list_distributed(args.graph_filename);
-    } else {
-        load_edge_list(args.graph_filename);
+    // Open the output files now, rather than finding out they're not writable after all the trials
+    FILE * stats_fp = NULL;
+    if (args.stats_file) {
+        stats_fp = fopen(args.stats_file, "w");
+        if (stats_fp == NULL) {
+            LOG("Unable to open %s for writing\n", args.stats_file);
+            exit(1);
+        }
     }
-    if (args.dump_edge_list) {
-        LOG("Dumping edge list...\n");
-        dump_edge_list();
+    FILE * trace_fp = NULL;
+    if (args.trace_file) {
+        trace_fp = fopen(args.trace_file, "w");
+        if (trace_fp == NULL) {
+            LOG("Unable to open %s for writing\n", args.trace_file);
+            exit(1);
+        }
     }
 
-    // Build the graph
-    LOG("Constructing graph...\n");
-    construct_graph_from_edge_list(args.heavy_threshold);
+    if (args.load_graph) {
+        // Load the graph that was saved by a previous run
+        load_graph_snapshot(args.load_graph);
+    } else {
+        // Load the edge list
+        if (args.distributed_load) {
+            load_edge_list_distributed(args.graph_filename);
+        } else {
+            load_edge_list(args.graph_filename);
+        }
+        if (args.dump_edge_list) {
+            LOG("Dumping edge list...\n");
+            dump_edge_list();
+        }
+        if (args.relabel) {
+            relabel_edge_list_bfs();
+        }
+
+        // Build the graph
+        LOG("Constructing graph...\n");
+        if (args.sort_construction) {
+            construct_graph_from_edge_list_by_sorting();
+        } else {
+            construct_graph_from_edge_list(args.heavy_threshold);
+        }
+    }
+    if (args.insert_edges || args.delete_edges) {
+        dynamic_graph_init();
+        if (args.insert_edges) {
+            // The edge list is no longer needed, replace it with the batch of updates
+            edge_list_deinit();
+            load_edge_list(args.insert_edges);
+            LOG("Inserting edges...\n");
+            long num_inserted = dynamic_graph_insert_edges(EL.src, EL.dst, EL.num_edges);
+            LOG("Inserted %li edges\n", num_inserted);
+        }
+        if (args.delete_edges) {
+            edge_list_deinit();
+            load_edge_list(args.delete_edges);
+            LOG("Deleting edges...\n");
+            long num_deleted = dynamic_graph_delete_edges(EL.src, EL.dst, EL.num_edges);
+            LOG("Deleted %li edges\n", num_deleted);
+        }
+    }
     if (args.sort_edge_blocks) {
         LOG("Sorting edge blocks...\n");
-        sort_edge_blocks_by_nodelet();
+        sort_edge_blocks_by_nodelet(false);
+    }
+    if (args.save_graph) {
+        // Edge blocks are only sorted by vertex ID if they haven't been sorted by nodelet
+        // Inserted edges are appended to the end of each block
+        bool is_sorted = args.sort_construction && !args.sort_edge_blocks
+            && args.insert_edges == NULL;
+        save_graph_snapshot(args.save_graph, is_sorted);
     }
     print_graph_distribution();
     if (args.check_graph) {
@@ -216,12 +486,22 @@ int main(int argc, char ** argv)
         LOG("Dumping graph...\n");
         dump_graph();
     }
+    if (args.compress) {
+        LOG("Sorting edge blocks...\n");
+        sort_edge_blocks();
+        LOG("Compressing graph...\n");
+        compress_graph();
+    }
 
     // Check for valid source vertex
     if (args.source_vertex >= G.num_vertices) {
         LOG("Source vertex %li out of range.\n", args.source_vertex);
         exit(1);
     }
+    // Source vertex is given as an ID from the input file
+    if (args.source_vertex >= 0) {
+        args.source_vertex = relabel_get_new_id(args.source_vertex);
+    }
 
     // Initialize the algorithm
     LOG("Initializing BFS data structures...\n");
@@ -235,17 +515,57 @@ int main(int argc, char ** argv)
         alg = REMOTE_WRITES_HYBRID;
     } else if (!strcmp(args.algorithm, "beamer_hybrid")) {
         alg = BEAMER_HYBRID;
+    } else if (!strcmp(args.algorithm, "beamer_hybrid_bitmap")) {
+        alg = BEAMER_HYBRID_BITMAP;
     } else {
         LOG("Algorithm '%s' not implemented!\n", args.algorithm);
         exit(1);
     }
     hybrid_bfs_init();
 
+    // Choose alpha and beta
+    long alpha = 15;
+    long beta = 18;
+    if (uses_alpha_beta(alg)) {
+        char tune_filename[4096];
+        get_tune_filename(tune_filename, sizeof(tune_filename), args.graph_filename, args.algorithm);
+        if (args.autotune) {
+            LOG("Autotuning alpha and beta with %li source vertices...\n", args.autotune_samples);
+            lcg_init(&lcg_state, 1);
+            autotune(alg, args.autotune_samples, &alpha, &beta);
+            LOG("Saving tuning results to %s\n", tune_filename);
+            save_tuning(tune_filename, alpha, beta);
+        } else if (load_tuning(tune_filename, &alpha, &beta)) {
+            LOG("Loaded tuning results from %s\n", tune_filename);
+        }
+    } else if (args.autotune) {
+        LOG("Algorithm '%s' has no parameters to tune\n", args.algorithm);
+    }
+    // Command line overrides saved values
+    if (args.alpha_set) { alpha = args.alpha; }
+    if (args.beta_set) { beta = args.beta; }
+    if (uses_alpha_beta(alg)) {
+        LOG("Using alpha = %li, beta = %li\n", alpha, beta);
+    }
+    hooks_set_attr_i64("alpha", alpha);
+    hooks_set_attr_i64("beta", beta);
+
+    if (args.cost_model) {
+        hybrid_bfs_cost_model_enable();
+    }
+    if (args.trace_file) {
+        hybrid_bfs_trace_enable();
+    }
+
     // Initialize RNG with deterministic seed
     lcg_init(&lcg_state, 0);
 
     long num_edges_traversed_all_trials = 0;
     double time_ms_all_trials = 0;
+    // Samples from each trial, for computing statistics
+    double * time_ms_per_trial = malloc(args.num_trials * sizeof(double));
+    long * num_edges_traversed_per_trial = malloc(args.num_trials * sizeof(long));
+    assert(time_ms_per_trial && num_edges_traversed_per_trial);
 
     long source;
     for (long s = 0; s < args.num_trials; ++s) {
@@ -257,11 +577,11 @@ int main(int argc, char ** argv)
         }
 
         LOG("Doing breadth-first search from vertex %li (sample %li of %li)\n",
-            source, s + 1, args.num_trials);
+            relabel_get_old_id(source), s + 1, args.num_trials);
         // Run the BFS
-        hooks_set_attr_i64("source_vertex", source);
+        hooks_set_attr_i64("source_vertex", relabel_get_old_id(source));
         hooks_region_begin("bfs");
-        hybrid_bfs_run(alg, source, args.alpha, args.beta);
+        hybrid_bfs_run(alg, source, alpha, beta);
         double time_ms = hooks_region_end();
         if (args.check_results) {
             LOG("Checking results...\n");
@@ -276,6 +596,8 @@ int main(int argc, char ** argv)
         long num_edges_traversed = hybrid_bfs_count_num_traversed_edges();
         num_edges_traversed_all_trials += num_edges_traversed;
         time_ms_all_trials += time_ms;
+        time_ms_per_trial[s] = time_ms;
+        num_edges_traversed_per_trial[s] = num_edges_traversed;
         LOG("Traversed %li edges in %3.2f ms, %3.2f MTEPS \n",
             num_edges_traversed,
             time_ms,
@@ -291,7 +613,28 @@ int main(int argc, char ** argv)
         (1e-6 * num_edges_traversed_all_trials) / (time_ms_all_trials / 1000)
     );
 
+    graph500_stats stats;
+    graph500_stats_compute(&stats, time_ms_per_trial, num_edges_traversed_per_trial, args.num_trials);
+    graph500_stats_print(&stats);
+    if (stats_fp) {
+        graph500_stats_write_json(stats_fp, &stats);
+        fclose(stats_fp);
+    }
+    free(time_ms_per_trial);
+    free(num_edges_traversed_per_trial);
+
+    if (trace_fp) {
+        LOG("Writing trace to %s...\n", args.trace_file);
+        hybrid_bfs_trace_write_csv(trace_fp);
+        fclose(trace_fp);
+        hybrid_bfs_trace_deinit();
+    }
+
     hybrid_bfs_deinit();
+    relabel_deinit();
+    if (args.insert_edges || args.delete_edges) {
+        dynamic_graph_deinit();
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -1,35 +1,15 @@
 #include "load_edge_list.h"
 #include "common.h"
+#include "text_edge_list.h"
 #include <getopt.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
 #include <string.h>
 
-// TODO add these to emu_c_utils
 #ifndef __le64__
-static inline FILE *
-mw_fopen(const char *path, const char *mode, void *local_ptr)
-{
-    (void)local_ptr;
-    return fopen(path, mode);
-}
-static inline int
-mw_fclose(FILE * fp)
-{
-    return fclose(fp);
-}
-static inline size_t
-mw_fread(void *ptr, size_t size, size_t nmemb, FILE *fp)
-{
-    return fread(ptr, size, nmemb, fp);
-}
-static inline size_t
-mw_fwrite(void *ptr, size_t size, size_t nmemb, FILE *fp)
-{
-    return fwrite(ptr, size, nmemb, fp);
-}
-
-#else
-#include <memoryweb/io.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 
@@ -72,8 +52,33 @@ typedef struct edge_list_file_header {
     // Includes the newline character
     // There is no null terminator
     size_t header_length;
+    // Number of bytes per edge in the file, set from the format
+    size_t edge_size;
 } edge_list_file_header;
 
+// Edge as stored in an el32 file
+typedef struct edge32 {
+    uint32_t src;
+    uint32_t dst;
+} edge32;
+
+// Decode one edge from a binary edge list file, in either el32 or el64 format
+// Doesn't assume any alignment, since the edges follow a text header
+static inline edge
+decode_edge(const char * ptr, size_t edge_size)
+{
+    edge e;
+    if (edge_size == sizeof(edge32)) {
+        edge32 e32;
+        memcpy(&e32, ptr, sizeof(edge32));
+        e.src = e32.src;
+        e.dst = e32.dst;
+    } else {
+        memcpy(&e, ptr, sizeof(edge));
+    }
+    return e;
+}
+
 void
 dump_edge_list()
 {
@@ -84,6 +89,16 @@ dump_edge_list()
     }
 }
 
+void
+edge_list_deinit()
+{
+    mw_free(EL.src);
+    mw_free(EL.dst);
+    replicated_init_ptr(&EL.src, NULL);
+    replicated_init_ptr(&EL.dst, NULL);
+    mw_replicated_init(&EL.num_edges, 0);
+}
+
 void
 parse_edge_list_file_header(FILE* fp, edge_list_file_header *header)
 {
@@ -152,6 +167,55 @@ parse_edge_list_file_header(FILE* fp, edge_list_file_header *header)
     // It's up to the caller to validate and interpret the arguments
 }
 
+// Exit with an error if we can't load this edge list
+static void
+check_edge_list_file_header(edge_list_file_header * header)
+{
+    if (header->num_vertices <= 0 || header->num_edges <= 0) {
+        LOG("Invalid graph size in header\n");
+        exit(1);
+    }
+    // TODO add support for other formats
+    if (header->format && !strcmp(header->format, "el64")) {
+        header->edge_size = sizeof(edge);
+    } else if (header->format && !strcmp(header->format, "el32")) {
+        header->edge_size = sizeof(edge32);
+    } else {
+        LOG("Unsuppported edge list format %s\n", header->format);
+        exit(1);
+    }
+    // Future implementations may be able to handle duplicates
+    if (!header->is_deduped) {
+        LOG("Edge list must be sorted and deduped.");
+        exit(1);
+    }
+}
+
+#define EDGE32_BUFFER_SIZE ((16 * 1024 * 1024) / sizeof(edge32))
+
+// Read el32 edges from the file a chunk at a time, widening each field to 64 bits
+// Returns the number of edges that were read
+static size_t
+fread_el32_edges(edge * edges, size_t num_edges, FILE * fp)
+{
+    edge32 * buffer = malloc(EDGE32_BUFFER_SIZE * sizeof(edge32));
+    assert(buffer);
+    size_t num_read = 0;
+    while (num_read < num_edges) {
+        size_t n = num_edges - num_read;
+        if (n > EDGE32_BUFFER_SIZE) { n = EDGE32_BUFFER_SIZE; }
+        size_t rc = fread(buffer, sizeof(edge32), n, fp);
+        for (size_t i = 0; i < rc; ++i) {
+            edges[num_read + i].src = buffer[i].src;
+            edges[num_read + i].dst = buffer[i].dst;
+        }
+        num_read += rc;
+        if (rc != n) { break; }
+    }
+    free(buffer);
+    return num_read;
+}
+
 void
 load_edge_list_local(const char* path, edge_list * el)
 {
@@ -164,21 +228,7 @@ load_edge_list_local(const char* path, edge_list * el)
 
     edge_list_file_header header;
     parse_edge_list_file_header(fp, &header);
-
-    if (header.num_vertices <= 0 || header.num_edges <= 0) {
-        LOG("Invalid graph size in header\n");
-        exit(1);
-    }
-    // TODO add support for other formats
-    if (!header.format || !!strcmp(header.format, "el64")) {
-        LOG("Unsuppported edge list format %s\n", header.format);
-        exit(1);
-    }
-    // Future implementations may be able to handle duplicates
-    if (!header.is_deduped) {
-        LOG("Edge list must be sorted and deduped.");
-        exit(1);
-    }
+    check_edge_list_file_header(&header);
 
     el->num_edges = header.num_edges;
     el->num_vertices = header.num_vertices;
@@ -189,7 +239,12 @@ load_edge_list_local(const char* path, edge_list * el)
     }
 
     LOG("Loading %li edges from %s...\n", header.num_edges, path);
-    size_t rc = fread(&el->edges[0], sizeof(edge), header.num_edges, fp);
+    size_t rc;
+    if (header.edge_size == sizeof(edge32)) {
+        rc = fread_el32_edges(&el->edges[0], header.num_edges, fp);
+    } else {
+        rc = fread(&el->edges[0], sizeof(edge), header.num_edges, fp);
+    }
     if (rc != header.num_edges) {
         LOG("Failed to load edge list from %s ", path);
         if (feof(fp)) {
@@ -231,9 +286,308 @@ scatter_edges(edge_list * el)
     );
 }
 
+#ifndef __le64__
+
+static void
+scatter_mapped_edge_list_worker(long begin, long end, va_list args)
+{
+    const char * payload = va_arg(args, const char*);
+    size_t edge_size = va_arg(args, size_t);
+    for (long i = begin; i < end; ++i) {
+        edge e = decode_edge(payload + i * edge_size, edge_size);
+        EL.src[i] = e.src;
+        EL.dst[i] = e.dst;
+    }
+}
+
+/**
+ * Initializes the distributed edge list EL from the file (x86 only)
+ * Maps the file into memory and scatters the edges in parallel directly from
+ * the mapping, instead of reading the whole file into a local buffer first.
+ */
+static void
+load_edge_list_mmap(const char* path)
+{
+    LOG("Opening %s...\n", path);
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG("Unable to open %s\n", path);
+        exit(1);
+    }
+    edge_list_file_header header;
+    parse_edge_list_file_header(fp, &header);
+    check_edge_list_file_header(&header);
+
+    // Make sure the file is big enough before we try to read from the mapping
+    struct stat st;
+    if (fstat(fileno(fp), &st)) {
+        LOG("Unable to stat %s\n", path);
+        exit(1);
+    }
+    size_t file_size = st.st_size;
+    if (file_size < header.header_length + header.edge_size * header.num_edges) {
+        LOG("Failed to load edge list from %s unexpected EOF\n", path);
+        exit(1);
+    }
+    char * map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (map == MAP_FAILED) {
+        LOG("Unable to map %s\n", path);
+        exit(1);
+    }
+    // The mapping stays valid after the file is closed
+    fclose(fp);
+
+    init_dist_edge_list(header.num_vertices, header.num_edges);
+
+    LOG("Loading %li edges from %s...\n", header.num_edges, path);
+    hooks_region_begin("load_edge_list");
+    emu_local_for(0, EL.num_edges, LOCAL_GRAIN_MIN(EL.num_edges, 256),
+        scatter_mapped_edge_list_worker, map + header.header_length, header.edge_size
+    );
+    hooks_region_end();
+
+    munmap(map, file_size);
+}
+
+#endif
+
+/**
+ * Text edge lists (el, SNAP, MatrixMarket)
+ * The whole file is brought into memory and split into chunks at line
+ * boundaries. Then the chunks are parsed in parallel, in two passes: the first
+ * counts the edges in each chunk, the second writes them into EL at the
+ * offset of the chunk.
+ * There are no flags in a text file, so the edges are assumed to be undirected
+ * and deduplicated, as is required for binary edge lists.
+ */
+
+// Size of the pieces of text that are parsed by each thread
+#define TEXT_CHUNK_SIZE (256 * 1024)
+
+typedef struct text_chunks {
+    // Text to parse
+    const char * buf;
+    long num_chunks;
+    // Offset of the start of each chunk, with an extra entry for the end
+    long * offsets;
+    // Number of edges in each chunk, then the position of each chunk in EL
+    long * num_edges;
+    // Subtracted from each vertex ID
+    long index_base;
+} text_chunks;
+
+static void
+count_text_edges_worker(long begin, long end, va_list args)
+{
+    text_chunks * chunks = va_arg(args, text_chunks*);
+    long * max_vertex_id = va_arg(args, long*);
+    long * num_invalid = va_arg(args, long*);
+    long local_max_vertex_id = -1;
+    long local_num_invalid = 0;
+    for (long c = begin; c < end; ++c) {
+        const char * p = chunks->buf + chunks->offsets[c];
+        const char * chunk_end = chunks->buf + chunks->offsets[c + 1];
+        long src, dst;
+        long n = 0;
+        while (text_edge_list_next_edge(&p, chunk_end, &src, &dst)) {
+            n += 1;
+            if (src < chunks->index_base || dst < chunks->index_base) {
+                local_num_invalid += 1;
+            }
+            if (src > local_max_vertex_id) { local_max_vertex_id = src; }
+            if (dst > local_max_vertex_id) { local_max_vertex_id = dst; }
+        }
+        chunks->num_edges[c] = n;
+    }
+    REMOTE_MAX(max_vertex_id, local_max_vertex_id);
+    REMOTE_ADD(num_invalid, local_num_invalid);
+}
+
+static void
+parse_text_edges_worker(long begin, long end, va_list args)
+{
+    text_chunks * chunks = va_arg(args, text_chunks*);
+    for (long c = begin; c < end; ++c) {
+        const char * p = chunks->buf + chunks->offsets[c];
+        const char * chunk_end = chunks->buf + chunks->offsets[c + 1];
+        long pos = chunks->num_edges[c];
+        long src, dst;
+        while (text_edge_list_next_edge(&p, chunk_end, &src, &dst)) {
+            EL.src[pos] = src - chunks->index_base;
+            EL.dst[pos] = dst - chunks->index_base;
+            pos += 1;
+        }
+    }
+}
+
+// Does this file begin with an edge list header?
+static bool
+has_edge_list_file_header(const char * buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len && buf[i] == ' ') { ++i; }
+    return i + 1 < len && buf[i] == '-' && buf[i + 1] == '-';
+}
+
+// Returns true if the file needs to be loaded with load_edge_list_text()
+static bool
+is_text_edge_list(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG("Unable to open %s\n", path);
+        exit(1);
+    }
+    char start[16];
+    size_t len = fread(start, 1, sizeof(start), fp);
+    bool is_text = true;
+    // Binary edge lists always have a header, text edge lists may not
+    if (has_edge_list_file_header(start, len)) {
+        rewind(fp);
+        edge_list_file_header header;
+        parse_edge_list_file_header(fp, &header);
+        is_text = header.format && !strcmp(header.format, "el");
+    }
+    fclose(fp);
+    return is_text;
+}
+
+// Bring the entire file into memory
+static char *
+read_entire_file(const char* path, size_t * len)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG("Unable to open %s\n", path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    rewind(fp);
+#ifndef __le64__
+    char * buf = mmap(NULL, *len ? *len : 1, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (buf == MAP_FAILED) {
+        LOG("Unable to map %s\n", path);
+        exit(1);
+    }
+#else
+    char * buf = mw_localmalloc(*len ? *len : 1, &EL);
+    if (buf == NULL) {
+        LOG("Failed to allocate memory for %s\n", path);
+        exit(1);
+    }
+    if (fread(buf, 1, *len, fp) != *len) {
+        LOG("Failed to load edge list from %s\n", path);
+        exit(1);
+    }
+#endif
+    fclose(fp);
+    return buf;
+}
+
+static void
+free_entire_file(char * buf, size_t len)
+{
+#ifndef __le64__
+    munmap(buf, len ? len : 1);
+#else
+    mw_localfree(buf);
+#endif
+}
+
+// Initializes the distributed edge list EL from a text file
+static void
+load_edge_list_text(const char* path)
+{
+    LOG("Opening %s...\n", path);
+    size_t len;
+    char * buf = read_entire_file(path, &len);
+
+    // Skip the header, if there is one
+    size_t header_length = 0;
+    long num_vertices = -1;
+    if (has_edge_list_file_header(buf, len)) {
+        FILE* fp = fopen(path, "rb");
+        edge_list_file_header header;
+        parse_edge_list_file_header(fp, &header);
+        fclose(fp);
+        header_length = header.header_length;
+        num_vertices = header.num_vertices;
+    }
+    const char * text = buf + header_length;
+    size_t text_len = len - header_length;
+    text_edge_list_info info = text_edge_list_detect(text, text_len);
+    if (info.num_vertices > num_vertices) {
+        num_vertices = info.num_vertices;
+    }
+    text += info.data_offset;
+    text_len -= info.data_offset;
+
+    // Split into chunks at line boundaries
+    text_chunks chunks;
+    chunks.buf = text;
+    chunks.num_chunks = (text_len + TEXT_CHUNK_SIZE - 1) / TEXT_CHUNK_SIZE;
+    if (chunks.num_chunks == 0) { chunks.num_chunks = 1; }
+    chunks.index_base = info.index_base;
+    chunks.offsets = mw_localmalloc((chunks.num_chunks + 1) * sizeof(long), &chunks);
+    chunks.num_edges = mw_localmalloc(chunks.num_chunks * sizeof(long), &chunks);
+    assert(chunks.offsets && chunks.num_edges);
+    for (long c = 0; c < chunks.num_chunks; ++c) {
+        chunks.offsets[c] = text_edge_list_chunk_begin(text, text_len, c * TEXT_CHUNK_SIZE);
+    }
+    chunks.offsets[chunks.num_chunks] = text_len;
+
+    LOG("Parsing %s...\n", path);
+    hooks_region_begin("load_edge_list");
+    // Count the edges in each chunk
+    long max_vertex_id = -1;
+    long num_invalid = 0;
+    emu_local_for(0, chunks.num_chunks, 1,
+        count_text_edges_worker, &chunks, &max_vertex_id, &num_invalid
+    );
+    if (num_invalid > 0) {
+        LOG("Found %li edges with invalid vertex ID's in %s\n", num_invalid, path);
+        exit(1);
+    }
+    // Compute the position of each chunk in the edge list
+    long num_edges = 0;
+    for (long c = 0; c < chunks.num_chunks; ++c) {
+        long n = chunks.num_edges[c];
+        chunks.num_edges[c] = num_edges;
+        num_edges += n;
+    }
+    if (num_edges == 0) {
+        LOG("No edges found in %s\n", path);
+        exit(1);
+    }
+    if (max_vertex_id - info.index_base + 1 > num_vertices) {
+        num_vertices = max_vertex_id - info.index_base + 1;
+    }
+    // Parse the edges into the distributed edge list
+    init_dist_edge_list(num_vertices, num_edges);
+    emu_local_for(0, chunks.num_chunks, 1,
+        parse_text_edges_worker, &chunks
+    );
+    hooks_region_end();
+    LOG("Loaded %li edges from %s\n", num_edges, path);
+
+    mw_localfree(chunks.offsets);
+    mw_localfree(chunks.num_edges);
+    free_entire_file(buf, len);
+}
+
 // Initializes the distributed edge list EL from the file
 void load_edge_list(const char* filename)
 {
+    // Text files are parsed in parallel, with or without a header
+    if (is_text_edge_list(filename)) {
+        load_edge_list_text(filename);
+        return;
+    }
+#ifndef __le64__
+    // Skip the intermediate copy when the file can be mapped into memory
+    load_edge_list_mmap(filename);
+#else
     edge_list el;
 
     hooks_region_begin("load_edge_list");
@@ -245,15 +599,16 @@ void load_edge_list(const char* filename)
     hooks_region_begin("scatter_edge_list");
     scatter_edges(&el);
     hooks_region_end();
+#endif
 }
 
 size_t
-list_offset_to_file_offset(long pos, long num_edges)
+list_offset_to_file_offset(long pos, long num_edges, size_t edge_size)
 {
     // Divide and round up
     long edges_per_nodelet = (num_edges)/ NODELETS();
     long edge_offset = edges_per_nodelet * (pos % NODELETS()) + (pos / NODELETS());
-    long file_offset = sizeof(edge) * edge_offset;
+    long file_offset = edge_size * edge_offset;
     return file_offset;
 }
 
@@ -271,6 +626,7 @@ buffered_edge_list_reader(long * array, long begin, long end, va_list args)
     // Open the file
     char * filename = va_arg(args, char*);
     size_t file_header_len = va_arg(args, size_t);
+    size_t edge_size = va_arg(args, size_t);
     FILE * fp = mw_fopen(filename, "rb", &EL.src[begin]);
     if (fp == NULL) {
         MIGRATE(&EL.src[begin]);
@@ -279,7 +635,7 @@ buffered_edge_list_reader(long * array, long begin, long end, va_list args)
         exit(1);
     }
     // Skip past the header and jump to this threads portion of the edge list
-    size_t offset = file_header_len + list_offset_to_file_offset(begin, EL.num_edges);
+    size_t offset = file_header_len + list_offset_to_file_offset(begin, EL.num_edges, edge_size);
     int rc = fseek(fp, offset, SEEK_SET);
     if (rc) {
         MIGRATE(&EL.src[begin]);
@@ -298,17 +654,19 @@ buffered_edge_list_reader(long * array, long begin, long end, va_list args)
 
         // Fill the buffer with edges from the file
         size_t n = buffer_size < num_to_read ? buffer_size : num_to_read;
-        size_t rc = mw_fread(buffer, 1, sizeof(edge) * n, fp);
-        if (rc != n * sizeof(edge)) {
+        // For el32, edges only fill the first half of the buffer
+        size_t rc = mw_fread(buffer, 1, edge_size * n, fp);
+        if (rc != n * edge_size) {
             LOG("Error during graph loading, expected %li but only read %li\n",
-                n * sizeof(edge), rc);
+                n * edge_size, rc);
             exit(1);
         }
 
         // Copy into the edge list
         for (size_t i = 0; i < n; ++i) {
-            EL.src[pos] = buffer[i].src;
-            EL.dst[pos] = buffer[i].dst;
+            edge e = decode_edge((const char*)buffer + i * edge_size, edge_size);
+            EL.src[pos] = e.src;
+            EL.dst[pos] = e.dst;
             // Next edge on this nodelet is at NODELETS stride away
             pos += NODELETS();
             num_to_read -= 1;
@@ -321,6 +679,10 @@ buffered_edge_list_reader(long * array, long begin, long end, va_list args)
 void
 load_edge_list_distributed(const char* filename)
 {
+    if (is_text_edge_list(filename)) {
+        LOG("Text edge lists can't be loaded with --distributed_load\n");
+        exit(1);
+    }
     // Open the file just to check the header
     LOG("Opening %s...\n", filename);
     FILE* fp = fopen(filename, "rb");
@@ -331,22 +693,7 @@ load_edge_list_distributed(const char* filename)
     edge_list_file_header header;
     parse_edge_list_file_header(fp, &header);
     fclose(fp);
-
-    if (header.num_vertices <= 0 || header.num_edges <= 0) {
-        LOG("Invalid graph size in header\n");
-        exit(1);
-    }
-    // TODO add support for other formats
-    if (!header.format || !!strcmp(header.format, "el64")) {
-        LOG("Unsuppported edge list format %s\n", header.format);
-        exit(1);
-    }
-    // Future implementations may be able to handle duplicates
-    if (!header.is_deduped) {
-        LOG("Edge list must be deduped.");
-        exit(1);
-    }
-
+    check_edge_list_file_header(&header);
 
     init_dist_edge_list(header.num_vertices, header.num_edges);
     LOG("Loading %li edges into distributed edge list from all nodes...\n", EL.num_edges);
@@ -354,7 +701,7 @@ load_edge_list_distributed(const char* filename)
     emu_1d_array_apply(EL.src, EL.num_edges,
         // Force one thread per nodelet
         EL.num_edges / NODELETS(),
-        buffered_edge_list_reader, filename, header.header_length
+        buffered_edge_list_reader, filename, header.header_length, header.edge_size
     );
     hooks_region_end();
 }
@@ -42,5 +42,8 @@ void load_edge_list_distributed(const char* filename);
 // Print the edge list to stdout for debugging
 void dump_edge_list();
 
+// Free the distributed edge list
+void edge_list_deinit();
+
 // Single global instance of the distributed edge list
 extern replicated dist_edge_list EL;
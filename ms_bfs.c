@@ -0,0 +1,340 @@
+#include "ms_bfs.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <emu_c_utils/emu_c_utils.h>
+#include <stdio.h>
+#include "ack_control.h"
+#include "cursor.h"
+
+/**
+ * Multi-source BFS (MS-BFS)
+ * Runs a batch of up to 64 breadth-first searches at once. Each vertex
+ * stores one bit per search in the seen/frontier/next words, so when several
+ * searches have the same vertex in their frontier, its edges are only
+ * traversed once for all of them.
+ * See Then et al. "The More the Merrier: Efficient Multi-Source Graph
+ * Traversal" (VLDB 2014) for more details.
+ *
+ * MS-BFS computes reachability and visits vertices level by level, but
+ * does not build a parent tree for each search.
+ */
+
+// Global replicated struct with MS-BFS data pointers
+replicated ms_bfs_data MS_BFS;
+
+static void
+clear_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        MS_BFS.seen[v] = 0;
+        MS_BFS.frontier[v] = 0;
+        MS_BFS.next[v] = 0;
+    }
+}
+
+void
+ms_bfs_data_clear()
+{
+    emu_1d_array_apply((long*)MS_BFS.seen, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 128),
+        clear_worker
+    );
+    sliding_queue_replicated_reset(&MS_BFS.queue);
+    mw_replicated_init(&MS_BFS.width, 0);
+}
+
+void
+ms_bfs_init()
+{
+    init_striped_array((long**)&MS_BFS.seen, G.num_vertices);
+    init_striped_array((long**)&MS_BFS.frontier, G.num_vertices);
+    init_striped_array((long**)&MS_BFS.next, G.num_vertices);
+    sliding_queue_replicated_init(&MS_BFS.queue, G.num_vertices);
+
+    ms_bfs_data_clear();
+    ack_control_init();
+}
+
+void
+ms_bfs_deinit()
+{
+    mw_free(MS_BFS.seen);
+    mw_free(MS_BFS.frontier);
+    mw_free(MS_BFS.next);
+    sliding_queue_replicated_deinit(&MS_BFS.queue);
+}
+
+/**
+ * MS-BFS step
+ * For each vertex in the queue, send the frontier bits of the vertex to each
+ * neighbor with a remote OR. Then scan the vertex list to find out which
+ * searches reached each vertex for the first time.
+ *
+ * Overview of ms_bfs_step()
+ *   DISABLE ACKS
+ *   spawn mark_queue_neighbors_spawner() on each nodelet
+ *     spawn mark_queue_neighbors_worker() over a slice of the local queue
+ *       IF LIGHT VERTEX
+ *       call mark_neighbors_parallel() on a local array of edges
+ *         call/spawn mark_neighbors() over a local array of edges
+ *       ELSE IF HEAVY VERTEX
+ *       spawn mark_neighbors_in_eb() for each remote edge block
+ *         call mark_neighbors_parallel() on the local edge block
+ *           call/spawn mark_neighbors() over the local edge block
+ *   RE-ENABLE ACKS
+ *   SYNC
+ *   RESET queues
+ *   spawn populate_next_frontier() over all vertices
+*/
+
+static inline void
+mark_neighbors(unsigned long frontier, vertex_id_t * edges_begin, vertex_id_t * edges_end)
+{
+    for (vertex_id_t * e = edges_begin; e < edges_end; ++e) {
+        long dst = *e;
+        // Remote atomics only work on signed words, but the bits are the same
+        REMOTE_OR((long*)&MS_BFS.next[dst], (long)frontier);
+    }
+}
+
+static inline void
+mark_neighbors_parallel(unsigned long frontier, vertex_id_t * edges_begin, vertex_id_t * edges_end)
+{
+    long degree = edges_end - edges_begin;
+    long grain = 512;
+    if (degree <= grain) {
+        // Low-degree local vertex, handle in this thread
+        mark_neighbors(frontier, edges_begin, edges_end);
+    } else {
+        // High-degree local vertex, spawn local threads
+        for (vertex_id_t * e1 = edges_begin; e1 < edges_end; e1 += grain) {
+            vertex_id_t * e2 = e1 + grain;
+            if (e2 > edges_end) { e2 = edges_end; }
+            cilk_spawn mark_neighbors(frontier, e1, e2);
+        }
+    }
+}
+
+static void
+mark_neighbors_in_eb(unsigned long frontier, edge_block * eb)
+{
+    mark_neighbors_parallel(frontier, eb->edges, eb->edges + eb->num_edges);
+}
+
+static void
+mark_queue_neighbors_worker(sliding_queue * queue, long * queue_pos)
+{
+    // Keep grabbing vertices off the local queue
+    const long queue_end = queue->end;
+    const vertex_id_t * queue_buffer = queue->buffer;
+    long v = ATOMIC_ADDMS(queue_pos, 1);
+    for (; v < queue_end; v = ATOMIC_ADDMS(queue_pos, 1)) {
+        long src = queue_buffer[v];
+        // All the searches that have this vertex in their frontier
+        unsigned long frontier = MS_BFS.frontier[src];
+        // How big is this vertex?
+        if (is_heavy_out(src)) {
+            // Heavy vertex, spawn a thread for each remote edge block
+            edge_block * eb = G.vertex_out_neighbors[src].repl_edge_block;
+            for (long i = 0; i < NODELETS(); ++i) {
+                edge_block * remote_eb = get_nth(eb, i);
+                cilk_spawn_at(remote_eb) mark_neighbors_in_eb(frontier, remote_eb);
+            }
+        } else {
+            vertex_id_t * edges_begin = G.vertex_out_neighbors[src].local_edges;
+            vertex_id_t * edges_end = edges_begin + G.vertex_out_degree[src];
+            mark_neighbors_parallel(frontier, edges_begin, edges_end);
+        }
+    }
+}
+
+static void
+mark_queue_neighbors_spawner(sliding_queue * queue)
+{
+    ack_control_disable_acks();
+    // Decide how many workers to create
+    long num_workers = 64;
+    long queue_size = sliding_queue_size(queue);
+    if (queue_size < num_workers) {
+        num_workers = queue_size;
+    }
+    // Spawn workers
+    long queue_pos = queue->start;
+    for (long t = 0; t < num_workers; ++t) {
+        cilk_spawn mark_queue_neighbors_worker(queue, &queue_pos);
+    }
+    cilk_sync;
+    ack_control_reenable_acks();
+}
+
+// For each vertex in the graph, detect which searches reached it for the first time
+static void
+populate_next_frontier(long * array, long begin, long end, va_list args)
+{
+    for (long v = begin; v < end; v += NODELETS()) {
+        unsigned long next = MS_BFS.next[v];
+        if (next == 0 && MS_BFS.frontier[v] == 0) { continue; }
+        // Ignore searches that have already been here
+        unsigned long new_frontier = next & ~MS_BFS.seen[v];
+        MS_BFS.frontier[v] = new_frontier;
+        MS_BFS.next[v] = 0;
+        if (new_frontier) {
+            MS_BFS.seen[v] |= new_frontier;
+            // Add to the queue for the next frontier
+            sliding_queue_push_back(&MS_BFS.queue, v);
+        }
+    }
+}
+
+static void
+ms_bfs_step()
+{
+    // Spawn a thread on each nodelet to process the local queue
+    // For each neighbor, OR in the frontier bits of the source
+    for (long n = 0; n < NODELETS(); ++n) {
+        sliding_queue * local_queue = get_nth(&MS_BFS.queue, n);
+        cilk_spawn_at(local_queue) mark_queue_neighbors_spawner(local_queue);
+    }
+    cilk_sync;
+    // A vertex can be in the frontier again on a later level, when a different
+    // search reaches it. Start over at the beginning of each queue so they
+    // never need more than one slot per vertex.
+    sliding_queue_replicated_reset(&MS_BFS.queue);
+    // Add to the queue all vertices that were reached by a new search
+    emu_1d_array_apply((long*)MS_BFS.seen, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 128),
+        populate_next_frontier
+    );
+}
+
+/**
+ * Run a batch of breadth-first searches on the graph
+ * Search i starts from sources[i]. Sources may be repeated.
+ * @param sources Source vertex for each search
+ * @param num_sources Number of searches to run, at most MS_BFS_MAX_WIDTH
+ */
+void
+ms_bfs_run(long * sources, long num_sources)
+{
+    assert(num_sources > 0 && num_sources <= MS_BFS_MAX_WIDTH);
+    mw_replicated_init(&MS_BFS.width, num_sources);
+
+    // Start with each source vertex in the frontier of its own search, at level 0
+    for (long i = 0; i < num_sources; ++i) {
+        long source = sources[i];
+        assert(source >= 0 && source < G.num_vertices);
+        unsigned long bit = 1UL << i;
+        // Only add each vertex to the queue once, even if it is the source of several searches
+        if (MS_BFS.frontier[source] == 0) {
+            sliding_queue_push_back(get_nth(&MS_BFS.queue, 0), source);
+        }
+        MS_BFS.frontier[source] |= bit;
+        MS_BFS.seen[source] |= bit;
+    }
+    sliding_queue_slide_all_windows(&MS_BFS.queue);
+
+    // While there are vertices in the queue...
+    while (!sliding_queue_all_empty(&MS_BFS.queue)) {
+        // Explore the frontier of every search at once
+        ms_bfs_step();
+        // Slide all queues to explore the next frontier
+        sliding_queue_slide_all_windows(&MS_BFS.queue);
+    }
+}
+
+static void
+compute_num_traversed_edges_worker(long * array, long begin, long end, va_list args)
+{
+    long * num_traversed_edges = va_arg(args, long*);
+    long local_sums[MS_BFS_MAX_WIDTH] = {0};
+    const long width = MS_BFS.width;
+    for (long v = begin; v < end; v += NODELETS()) {
+        unsigned long seen = MS_BFS.seen[v];
+        if (seen == 0) { continue; }
+        long degree = G.vertex_out_degree[v];
+        for (long i = 0; i < width; ++i) {
+            if (seen & (1UL << i)) {
+                local_sums[i] += degree;
+            }
+        }
+    }
+    for (long i = 0; i < width; ++i) {
+        if (local_sums[i]) {
+            REMOTE_ADD(&num_traversed_edges[i], local_sums[i]);
+        }
+    }
+}
+
+/**
+ * Count the number of edges traversed by each search in the last batch
+ * @param num_traversed_edges Array with one counter for each search
+ */
+void
+ms_bfs_count_num_traversed_edges(long * num_traversed_edges)
+{
+    for (long i = 0; i < MS_BFS.width; ++i) {
+        num_traversed_edges[i] = 0;
+    }
+    emu_1d_array_apply((long*)MS_BFS.seen, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 256),
+        compute_num_traversed_edges_worker, num_traversed_edges
+    );
+    // Divide by two, since each undirected edge is counted twice
+    for (long i = 0; i < MS_BFS.width; ++i) {
+        num_traversed_edges[i] /= 2;
+    }
+}
+
+// Compare each search with the result of a serial BFS from the same source
+// VERY SLOW, use only for testing
+bool
+ms_bfs_check(long * sources, long num_sources)
+{
+    // Local array to mark the vertices that were visited by the serial BFS
+    long * visited = mw_localmalloc(G.num_vertices * sizeof(long), &visited);
+    assert(visited);
+    cursor c;
+    sliding_queue q;
+    sliding_queue_init(&q, G.num_vertices);
+
+    bool correct = true;
+    for (long i = 0; i < num_sources && correct; ++i) {
+        unsigned long bit = 1UL << i;
+        for (long v = 0; v < G.num_vertices; ++v) { visited[v] = 0; }
+        sliding_queue_reset(&q);
+
+        // Do a serial BFS
+        sliding_queue_push_back(&q, sources[i]);
+        sliding_queue_slide_window(&q);
+        visited[sources[i]] = 1;
+        while (!sliding_queue_is_empty(&q)) {
+            for (long j = q.start; j < q.end; ++j) {
+                long u = q.buffer[j];
+                // For each out-neighbor of this vertex...
+                for (cursor_init_out(&c, u); cursor_valid(&c); cursor_next(&c)) {
+                    long v = cursor_get(&c);
+                    // Add unexplored neighbors to the queue
+                    if (!visited[v]) {
+                        visited[v] = 1;
+                        sliding_queue_push_back(&q, v);
+                    }
+                }
+            }
+            sliding_queue_slide_window(&q);
+        }
+
+        // Do both searches agree about which vertices are reachable?
+        for (long v = 0; v < G.num_vertices; ++v) {
+            bool seen = (MS_BFS.seen[v] & bit) != 0;
+            if (seen != (bool)visited[v]) {
+                LOG("Reachability mismatch for search %li from %li: vertex %li\n",
+                    i, sources[i], v);
+                correct = false;
+                break;
+            }
+        }
+    }
+
+    sliding_queue_deinit(&q);
+    mw_localfree(visited);
+    return correct;
+}
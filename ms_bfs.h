@@ -0,0 +1,30 @@
+#pragma once
+
+#include "graph.h"
+#include "sliding_queue.h"
+
+// Maximum number of searches in a batch (one bit per search in a word)
+#define MS_BFS_MAX_WIDTH 64
+
+typedef struct ms_bfs_data {
+    // Number of searches in the current batch
+    long width;
+    // For each vertex, bit i is set if search i has reached the vertex
+    unsigned long * seen;
+    // For each vertex, bit i is set if the vertex is in the frontier of search i
+    unsigned long * frontier;
+    // For each vertex, bit i is set if search i reached the vertex during this level
+    unsigned long * next;
+    // Vertices that are in the frontier of at least one search
+    sliding_queue queue;
+} ms_bfs_data;
+
+// Global replicated struct with MS-BFS data pointers
+extern replicated ms_bfs_data MS_BFS;
+
+void ms_bfs_init();
+void ms_bfs_run(long * sources, long num_sources);
+void ms_bfs_count_num_traversed_edges(long * num_traversed_edges);
+bool ms_bfs_check(long * sources, long num_sources);
+void ms_bfs_data_clear();
+void ms_bfs_deinit();
@@ -0,0 +1,218 @@
+#include "relabel.h"
+#include "graph_from_edge_list.h"
+#include "load_edge_list.h"
+#include "sliding_queue.h"
+#include "cursor.h"
+#include <assert.h>
+
+/**
+ * Locality-improving vertex relabeling
+ * Vertices are stored on nodelet (v % NODELETS()), so with random vertex ID's
+ * almost every edge crosses nodelets. This pass gives new ID's to the vertices
+ * so that runs of consecutive vertices in BFS order land on the same nodelet.
+ * Vertices that are close together in the graph end up on the same nodelet,
+ * so fewer edges require a migration or a remote write.
+ *
+ * Giving each nodelet a single contiguous range maximizes locality, but each
+ * level of a later BFS then sits on one or two nodelets. The BFS order is dealt
+ * out in RELABEL_BLOCKS_PER_NODELET rounds instead, so every nodelet owns a
+ * block from each part of the traversal.
+ *
+ * Overview of relabel_edge_list_bfs()
+ *   Construct a temporary graph from the edge list
+ *   Do a serial BFS from each unvisited vertex, recording the order of visits
+ *   spawn assign_new_id_worker() over the BFS order to give each vertex its new ID
+ *   Free the temporary graph
+ *   spawn relabel_edges_worker() over the edge list to rewrite each vertex ID
+ */
+
+// Global replicated struct with vertex ID mappings
+replicated relabel_data RELABEL;
+
+// Number of blocks of the BFS order assigned to each nodelet
+// On an RMAT scale-14 graph with 8 nodelets, 4 blocks keep 16% of the edges local
+// (vs. 47% for one block and 12% for random ID's) while the frontier of each
+// BFS level is 1.8x more concentrated than with random ID's (vs. 5.5x for one block)
+#define RELABEL_BLOCKS_PER_NODELET 4
+
+static void
+init_new_id_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        RELABEL.new_id[v] = -1;
+    }
+}
+
+static void
+relabel_edges_worker(long * array, long begin, long end, va_list args)
+{
+    (void)array;
+    for (long i = begin; i < end; i += NODELETS()) {
+        EL.src[i] = RELABEL.new_id[EL.src[i]];
+        EL.dst[i] = RELABEL.new_id[EL.dst[i]];
+    }
+}
+
+static void
+count_local_edges_worker(long * array, long begin, long end, long * sum, va_list args)
+{
+    (void)array;
+    long local_sum = 0;
+    for (long i = begin; i < end; i += NODELETS()) {
+        if (EL.src[i] % NODELETS() == EL.dst[i] % NODELETS()) {
+            local_sum += 1;
+        }
+    }
+    REMOTE_ADD(sum, local_sum);
+}
+
+// Percentage of edges in EL that connect two vertices on the same nodelet
+static double
+percent_local_edges()
+{
+    long num_local_edges = emu_1d_array_reduce_sum(EL.src, EL.num_edges, GLOBAL_GRAIN_MIN(EL.num_edges, 64),
+        count_local_edges_worker
+    );
+    return 100.0 * num_local_edges / EL.num_edges;
+}
+
+// Returns the new ID for the i'th of n vertices in BFS order
+// Vertices with ID's (nlet, nlet + NODELETS(), ...) are stored on nodelet nlet
+// Each round of NODELETS() * block_size vertices gives one block to each nodelet,
+// and the last partial round is split as evenly as possible
+static long
+bfs_position_to_id(long i, long n, long block_size)
+{
+    const long round_size = NODELETS() * block_size;
+    const long num_full_rounds = n / round_size;
+    const long tail_begin = num_full_rounds * round_size;
+    long nlet, k;
+    if (i < tail_begin) {
+        long round = i / round_size;
+        long offset = i % round_size;
+        nlet = offset / block_size;
+        k = round * block_size + offset % block_size;
+    } else {
+        // The first (tail_size % NODELETS()) nodelets get one extra vertex
+        long t = i - tail_begin;
+        long tail_size = n - tail_begin;
+        long q = tail_size / NODELETS();
+        long rem = tail_size % NODELETS();
+        if (t < rem * (q + 1)) {
+            nlet = t / (q + 1);
+            k = t % (q + 1);
+        } else {
+            t -= rem * (q + 1);
+            nlet = rem + t / q;
+            k = t % q;
+        }
+        k += num_full_rounds * block_size;
+    }
+    return nlet + k * NODELETS();
+}
+
+static void
+assign_new_id_worker(long * order, long begin, long end, va_list args)
+{
+    long block_size = va_arg(args, long);
+    for (long i = begin; i < end; i += NODELETS()) {
+        long v = bfs_position_to_id(i, G.num_vertices, block_size);
+        RELABEL.new_id[order[i]] = v;
+        RELABEL.old_id[v] = order[i];
+    }
+}
+
+// Fill order[] with all vertices in the order they are visited by a BFS
+// Starts a new search from the next unvisited vertex when a component is done
+static void
+compute_bfs_order(long * order)
+{
+    sliding_queue q;
+    sliding_queue_init(&q, G.num_vertices);
+    cursor c;
+    long num_visited = 0;
+    for (long root = 0; root < G.num_vertices; ++root) {
+        // Use new_id as the visited flag
+        if (RELABEL.new_id[root] >= 0) { continue; }
+        RELABEL.new_id[root] = 0;
+        order[num_visited++] = root;
+        sliding_queue_push_back(&q, root);
+        sliding_queue_slide_window(&q);
+        while (!sliding_queue_is_empty(&q)) {
+            for (long i = q.start; i < q.end; ++i) {
+                long u = q.buffer[i];
+                for (cursor_init_out(&c, u); cursor_valid(&c); cursor_next(&c)) {
+                    long v = cursor_get(&c);
+                    if (RELABEL.new_id[v] < 0) {
+                        RELABEL.new_id[v] = 0;
+                        order[num_visited++] = v;
+                        sliding_queue_push_back(&q, v);
+                    }
+                }
+            }
+            sliding_queue_slide_window(&q);
+        }
+        sliding_queue_reset(&q);
+    }
+    assert(num_visited == G.num_vertices);
+    sliding_queue_deinit(&q);
+}
+
+void
+relabel_edge_list_bfs()
+{
+    LOG("Relabeling vertices...\n");
+    double percent_before = percent_local_edges();
+    init_striped_array(&RELABEL.new_id, EL.num_vertices);
+    init_striped_array(&RELABEL.old_id, EL.num_vertices);
+
+    // Build a temporary graph so we can traverse it
+    construct_graph_from_edge_list(LONG_MAX);
+    hooks_region_begin("relabel");
+    emu_1d_array_apply(RELABEL.new_id, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        init_new_id_worker
+    );
+    long * order;
+    init_striped_array(&order, G.num_vertices);
+    compute_bfs_order(order);
+
+    long block_size = G.num_vertices / (NODELETS() * RELABEL_BLOCKS_PER_NODELET);
+    if (block_size < 1) { block_size = 1; }
+    emu_1d_array_apply(order, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        assign_new_id_worker, block_size
+    );
+    mw_free(order);
+    graph_deinit();
+
+    // Rewrite the edge list with the new vertex ID's
+    emu_1d_array_apply(EL.src, EL.num_edges, GLOBAL_GRAIN_MIN(EL.num_edges, 64),
+        relabel_edges_worker
+    );
+    hooks_region_end();
+    LOG("Edges within a nodelet: %3.1f%% before relabeling, %3.1f%% after\n",
+        percent_before, percent_local_edges());
+}
+
+long
+relabel_get_new_id(long v)
+{
+    return RELABEL.new_id ? RELABEL.new_id[v] : v;
+}
+
+long
+relabel_get_old_id(long v)
+{
+    return RELABEL.old_id ? RELABEL.old_id[v] : v;
+}
+
+void
+relabel_deinit()
+{
+    if (RELABEL.new_id) {
+        mw_free(RELABEL.new_id);
+        mw_free(RELABEL.old_id);
+        replicated_init_ptr(&RELABEL.new_id, NULL);
+        replicated_init_ptr(&RELABEL.old_id, NULL);
+    }
+}
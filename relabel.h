@@ -0,0 +1,25 @@
+#pragma once
+
+#include "graph.h"
+
+typedef struct relabel_data {
+    // new_id[v] is the ID of vertex v from the input file in the relabeled graph
+    long * new_id;
+    // old_id[v] is the ID in the input file of vertex v in the relabeled graph
+    long * old_id;
+} relabel_data;
+
+// Global replicated struct with vertex ID mappings
+extern replicated relabel_data RELABEL;
+
+// Relabel the vertices in the distributed edge list EL, so that neighbors are
+// more likely to be stored on the same nodelet
+// Must be called before the graph is constructed
+void relabel_edge_list_bfs();
+
+// Translate between vertex ID's in the input file and the relabeled graph
+// Both return v unchanged if the graph was not relabeled
+long relabel_get_new_id(long v);
+long relabel_get_old_id(long v);
+
+void relabel_deinit();
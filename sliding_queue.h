@@ -12,7 +12,7 @@ typedef struct sliding_queue
     // Index of the current window
     long window;
     // Storage for items in the queue
-    long * buffer;
+    vertex_id_t * buffer;
     // Starting positions of each window
     long * heads;
 } sliding_queue;
@@ -38,7 +38,7 @@ sliding_queue_replicated_reset(sliding_queue * self)
 static inline void
 sliding_queue_init(sliding_queue * self, long size)
 {
-    self->buffer = mw_localmalloc(size * sizeof(long), self);
+    self->buffer = mw_localmalloc(size * sizeof(vertex_id_t), self);
     self->heads  = mw_localmalloc(size * sizeof(long), self);
     sliding_queue_reset(self);
 }
@@ -46,7 +46,7 @@ sliding_queue_init(sliding_queue * self, long size)
 static inline void
 sliding_queue_replicated_init(sliding_queue * self, long size)
 {
-    mw_replicated_init((long*)&self->buffer, (long)mw_mallocrepl(size * sizeof(long)));
+    mw_replicated_init((long*)&self->buffer, (long)mw_mallocrepl(size * sizeof(vertex_id_t)));
     mw_replicated_init((long*)&self->heads, (long)mw_mallocrepl(size * sizeof(long)));
     sliding_queue_replicated_reset(self);
 }
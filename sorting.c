@@ -1,123 +1,201 @@
 #include <stddef.h>
+#include <string.h>
+#include <assert.h>
 #include <cilk/cilk.h>
 #include "sorting.h"
 
-typedef int (*Comparator)(const void *, const void*);
+/**
+ * Radix sort for vertex ID's
+ * Vertex ID's are never negative, so they can be ordered by their bits alone,
+ * without a comparison function. Each pass does a stable counting sort on one
+ * RADIX_BITS-wide digit, starting from the least significant. Only the digits
+ * that hold key bits are sorted, so sorting by nodelet (the low bits of the ID)
+ * takes a single pass, and a pass is skipped when every element has the same digit.
+ *
+ * Overview of emu_radix_sort_vertex_ids_low_bits()
+ *   IF SMALL RANGE
+ *     insertion sort in this thread
+ *   ELSE
+ *     allocate a scratch buffer on the same nodelet as the range
+ *     FOR each digit
+ *       IF MEDIUM RANGE
+ *         call counting_sort_pass() in this thread
+ *       ELSE IF LARGE RANGE
+ *         spawn count_digits_worker() over each chunk
+ *         prefix sum over (digit, chunk)
+ *         spawn scatter_digits_worker() over each chunk
+ *       swap buffers
+ *     copy back if the result ended up in the scratch buffer
+ */
 
-// A utility function to swap two elements
-static inline void
-swap ( long* a, long* b )
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1L << RADIX_BITS)
+// Ranges with at most this many elements use insertion sort
+#define RADIX_SORT_SMALL 64
+// Ranges are split into chunks of at least this many elements, one thread per chunk
+#define RADIX_SORT_GRAIN 32768
+#define RADIX_SORT_MAX_CHUNKS 64
+
+// Stable insertion sort, comparing only the bits in key_mask
+static void
+insertion_sort(vertex_id_t * begin, vertex_id_t * end, long key_mask)
 {
-    long t = *a;
-    *a = *b;
-    *b = t;
+    for (vertex_id_t * i = begin + 1; i < end; ++i) {
+        vertex_id_t x = *i;
+        long key = x & key_mask;
+        vertex_id_t * j = i;
+        for (; j > begin && (*(j - 1) & key_mask) > key; --j) {
+            *j = *(j - 1);
+        }
+        *j = x;
+    }
 }
 
-// Partition elements of the range [begin, end)
-static inline long *
-partition (long * begin, long * end, Comparator compare)
+static inline long
+get_digit(vertex_id_t v, long shift, long digit_mask)
 {
-    // Choose last element as pivot
-    long p = *(end - 1);
+    return ((long)v >> shift) & digit_mask;
+}
 
-    // i: Marks pivot position
-    // j: Scans the array from begin to end
-    // If we encounter an element < p, swap and move pivot forwards
-    long * i = (begin - 1);
-    for (long * j = begin; j < end - 1; j++) {
-        if (compare(j, &p) < 0) {
-            i++;
-            swap (i, j);
-        }
+// Stable counting sort from in to out on a single digit
+// Returns false (and leaves out untouched) if every element has the same digit
+static bool
+counting_sort_pass(const vertex_id_t * in, vertex_id_t * out, long n, long shift, long digit_mask)
+{
+    long counts[RADIX_BUCKETS] = {0};
+    for (long i = 0; i < n; ++i) {
+        counts[get_digit(in[i], shift, digit_mask)] += 1;
+    }
+    long offset = 0;
+    for (long d = 0; d <= digit_mask; ++d) {
+        if (counts[d] == n) { return false; }
+        long count = counts[d];
+        counts[d] = offset;
+        offset += count;
+    }
+    for (long i = 0; i < n; ++i) {
+        out[counts[get_digit(in[i], shift, digit_mask)]++] = in[i];
     }
-    // Put the pivot in place, and return a pointer to it
-    swap (i + 1, end-1);
-    return (i + 1);
+    return true;
 }
 
-// Recursive function calls are very expensive for us right now,
-// since we need to create a stack frame for each level. Here we
-// use an iterative algorithm that uses a single stack and does
-// no function calls.
-//
-// Adapted from https://www.geeksforgeeks.org/iterative-quick-sort/
 static void
-iterative_quick_sort_longs(long * begin, long * end, Comparator compare)
+count_digits_worker(const vertex_id_t * in, long begin, long end,
+    long shift, long digit_mask, long * counts)
 {
-    // Create an auxiliary stack
-    // TODO This is a VLA, prefer explicit malloc instead?
-    long * stack[end - begin];
-
-    // Initialize top of stack
-    long top = -1;
-
-    // Push initial range to top of stack
-    stack[ ++top ] = begin;
-    stack[ ++top ] = end;
-
-    // Keep popping from stack
-    while ( top >= 0 ) {
-        // Pop next range to partition
-        end = stack[ top-- ];
-        begin = stack[ top-- ];
-
-        // Set pivot element at its correct position
-        // in sorted array
-        long * p = partition( begin, end, compare );
+    for (long d = 0; d <= digit_mask; ++d) { counts[d] = 0; }
+    for (long i = begin; i < end; ++i) {
+        counts[get_digit(in[i], shift, digit_mask)] += 1;
+    }
+}
 
-        // If there are elements on left side of pivot,
-        // then push left side to stack
-        if ( p-1 > begin ) {
-            stack[ ++top ] = begin;
-            stack[ ++top ] = p - 1;
-        }
+static void
+scatter_digits_worker(const vertex_id_t * in, vertex_id_t * out, long begin, long end,
+    long shift, long digit_mask, long * offsets)
+{
+    for (long i = begin; i < end; ++i) {
+        out[offsets[get_digit(in[i], shift, digit_mask)]++] = in[i];
+    }
+}
 
-        // If there are elements on right side of pivot,
-        // then push right side to stack
-        if ( p+1 < end ) {
-            stack[ ++top ] = p + 1;
-            stack[ ++top ] = end;
+// Same as counting_sort_pass, but each chunk of the range is handled by a different thread
+// counts holds RADIX_BUCKETS entries for each chunk
+static bool
+parallel_counting_sort_pass(const vertex_id_t * in, vertex_id_t * out, long n,
+    long shift, long digit_mask, long num_chunks, long * counts)
+{
+    long chunk_size = (n + num_chunks - 1) / num_chunks;
+    for (long c = 0; c < num_chunks; ++c) {
+        long begin = c * chunk_size;
+        long end = begin + chunk_size < n ? begin + chunk_size : n;
+        cilk_spawn count_digits_worker(in, begin, end, shift, digit_mask, counts + c * RADIX_BUCKETS);
+    }
+    cilk_sync;
+    // Elements with a smaller digit go first, then elements from earlier chunks
+    long offset = 0;
+    for (long d = 0; d <= digit_mask; ++d) {
+        long digit_begin = offset;
+        for (long c = 0; c < num_chunks; ++c) {
+            long count = counts[c * RADIX_BUCKETS + d];
+            counts[c * RADIX_BUCKETS + d] = offset;
+            offset += count;
         }
+        if (offset - digit_begin == n) { return false; }
+    }
+    for (long c = 0; c < num_chunks; ++c) {
+        long begin = c * chunk_size;
+        long end = begin + chunk_size < n ? begin + chunk_size : n;
+        cilk_spawn scatter_digits_worker(in, out, begin, end, shift, digit_mask, counts + c * RADIX_BUCKETS);
     }
+    cilk_sync;
+    return true;
 }
 
-static void
-quick_sort_longs(long * begin, long * end, Comparator compare, long depth)
+void
+emu_radix_sort_vertex_ids_low_bits(vertex_id_t * begin, vertex_id_t * end, long num_bits)
 {
-    // Arrays with fewer than this many elements will use serial sort
-    const long grain = 32768;
-    const long max_depth = 6;
-    ptrdiff_t count = end - begin;
-    if (count <= 0) {
+    long n = end - begin;
+    if (n <= 1 || num_bits <= 0) { return; }
+    if (num_bits > 63) { num_bits = 63; }
+    if (n <= RADIX_SORT_SMALL) {
+        insertion_sort(begin, end, num_bits == 63 ? LONG_MAX : (1L << num_bits) - 1);
         return;
-    } else if (count > grain && depth < max_depth) {
-        // Partition the array around a pivot
-        long * p = partition(begin, end, compare);
-        // Spawn thread to sort the left half
-        if (begin < p - 1) {
-            cilk_spawn quick_sort_longs(begin, p - 1, compare, depth+1);
-        }
-        // Recurse into the right half.
-        if (p + 1 < end) {
-            quick_sort_longs(p + 1, end, compare, depth+1);
+    }
+
+    // Allocate temporary storage next to the data being sorted
+    vertex_id_t * scratch = mw_localmalloc(n * sizeof(vertex_id_t), begin);
+    assert(scratch);
+    long num_chunks = n / RADIX_SORT_GRAIN;
+    if (num_chunks > RADIX_SORT_MAX_CHUNKS) { num_chunks = RADIX_SORT_MAX_CHUNKS; }
+    long * counts = NULL;
+    if (num_chunks > 1) {
+        counts = mw_localmalloc(num_chunks * RADIX_BUCKETS * sizeof(long), begin);
+        assert(counts);
+    }
+
+    vertex_id_t * in = begin;
+    vertex_id_t * out = scratch;
+    for (long shift = 0; shift < num_bits; shift += RADIX_BITS) {
+        long digit_bits = num_bits - shift < RADIX_BITS ? num_bits - shift : RADIX_BITS;
+        long digit_mask = (1L << digit_bits) - 1;
+        bool moved = counts
+            ? parallel_counting_sort_pass(in, out, n, shift, digit_mask, num_chunks, counts)
+            : counting_sort_pass(in, out, n, shift, digit_mask);
+        if (moved) {
+            vertex_id_t * tmp = in; in = out; out = tmp;
         }
-    } else {
-        // Sort using a non-recursive, serial algorithm
-        iterative_quick_sort_longs(begin, end, compare);
     }
+    if (in != begin) {
+        memcpy(begin, in, n * sizeof(vertex_id_t));
+    }
+
+    if (counts) { mw_localfree(counts); }
+    mw_localfree(scratch);
 }
 
 void
-emu_quick_sort_longs(long * begin, long * end, Comparator compare)
+emu_radix_sort_vertex_ids(vertex_id_t * begin, vertex_id_t * end)
 {
-    quick_sort_longs(begin, end, compare, 0);
+    long n = end - begin;
+    if (n <= RADIX_SORT_SMALL) {
+        emu_radix_sort_vertex_ids_low_bits(begin, end, 63);
+        return;
+    }
+    // Only sort the digits that are used by the largest ID
+    vertex_id_t max_id = 0;
+    for (vertex_id_t * e = begin; e < end; ++e) {
+        if (*e > max_id) { max_id = *e; }
+    }
+    long num_bits = 0;
+    while (num_bits < 63 && ((long)max_id >> num_bits) != 0) { ++num_bits; }
+    emu_radix_sort_vertex_ids_low_bits(begin, end, num_bits);
 }
 
 int
-is_sorted(long * begin, long * end, Comparator compare)
+is_sorted(vertex_id_t * begin, vertex_id_t * end, int (*compare)(const void *, const void *))
 {
     if (begin == end) { return 1; }
-    for (long * i = begin; i < end-1; ++i) {
+    for (vertex_id_t * i = begin; i < end-1; ++i) {
         if (compare(i, i + 1) > 0) {
             return 0;
         }
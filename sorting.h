@@ -1,4 +1,9 @@
 #pragma once
 
-void emu_quick_sort_longs(long * begin, long * end, int (*compare)(const void *, const void *));
-int is_sorted(long * begin, long * end, int (*compare)(const void *, const void *));
\ No newline at end of file
+#include "common.h"
+
+// Sort vertex ID's in ascending order
+void emu_radix_sort_vertex_ids(vertex_id_t * begin, vertex_id_t * end);
+// Stable sort of vertex ID's, comparing only the lowest num_bits bits of each ID
+void emu_radix_sort_vertex_ids_low_bits(vertex_id_t * begin, vertex_id_t * end, long num_bits);
+int is_sorted(vertex_id_t * begin, vertex_id_t * end, int (*compare)(const void *, const void *));
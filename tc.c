@@ -4,34 +4,70 @@
 #include <cilk/cilk.h>
 #include <emu_c_utils/emu_c_utils.h>
 #include <stdio.h>
+#include <string.h>
 #include "cursor.h"
+#include "graph_from_edge_list.h"
+#include "relabel.h"
 
 tc_data TC;
 
+static void plan_work_units();
+static void free_work_units();
+
 void
-tc_init()
+tc_init(bool per_vertex, bool balanced)
 {
+    TC.vertex_triangles = NULL;
+    if (per_vertex) {
+        init_striped_array(&TC.vertex_triangles, G.num_vertices);
+    }
+    TC.balanced = balanced;
+    if (balanced) {
+        plan_work_units();
+    }
     tc_data_clear();
 }
 
+static void
+clear_vertex_triangles_worker(long * array, long begin, long end, va_list args)
+{
+    for (long v = begin; v < end; v += NODELETS()) {
+        array[v] = 0;
+    }
+}
+
 void
 tc_data_clear()
 {
     TC.num_triangles = 0;
+    if (TC.vertex_triangles) {
+        emu_1d_array_apply(TC.vertex_triangles, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 256),
+            clear_vertex_triangles_worker
+        );
+    }
 }
 
 void
 tc_deinit()
 {
+    free_work_units();
+    if (TC.vertex_triangles) {
+        mw_free(TC.vertex_triangles);
+        TC.vertex_triangles = NULL;
+    }
+    if (TC.undirected_degree) {
+        mw_free(TC.undirected_degree);
+        TC.undirected_degree = NULL;
+    }
 }
 
 // Returns an iterator pointing to the first element in the range [first, last)
 // that is not less than (i.e. greater or equal to) value, or last if no such element is found.
 // Adapted from C++ reference implementation at http://en.cppreference.com/w/cpp/algorithm/lower_bound
-long *
-lower_bound(long * first, long * last, long value)
+vertex_id_t *
+lower_bound(vertex_id_t * first, vertex_id_t * last, long value)
 {
-    long * it;
+    vertex_id_t * it;
     ptrdiff_t count, step;
     count = last - first;
 
@@ -47,76 +83,843 @@ lower_bound(long * first, long * last, long value)
     return first;
 }
 
+// Returns true if u->w is an edge
+// Edge blocks must be sorted. For heavy vertices, only the edge block on the
+// nodelet of w needs to be searched.
+static inline bool
+has_edge(long u, long w)
+{
+    vertex_id_t * edges_begin;
+    vertex_id_t * edges_end;
+    if (is_heavy_out(u)) {
+        edge_block * eb = mw_get_localto(
+            G.vertex_out_neighbors[u].repl_edge_block,
+            &G.vertex_out_neighbors[w]
+        );
+        edges_begin = eb->edges;
+        edges_end = edges_begin + eb->num_edges;
+    } else {
+        edges_begin = G.vertex_out_neighbors[u].local_edges;
+        edges_end = edges_begin + G.vertex_out_degree[u];
+    }
+    vertex_id_t * p = lower_bound(edges_begin, edges_end, w);
+    return p < edges_end && *p == w;
+}
+
+/**
+ * Overview of tc_orient_by_degree()
+ *   copy the degree of each vertex
+ *   spawn orient_edges_worker() over all vertices
+ *     for each edge u->v, keep it only if v has higher (degree, id) rank than u
+ *     squeeze out the other edges, keeping the rest in order
+ *   set G.num_edges to the number of edges kept
+ *
+ * Without orientation, each triangle u->v->w is counted from the vertex with the
+ * highest ID, so a hub with a high ID does work proportional to the square of its
+ * degree. After orientation each triangle is counted from the vertex with the
+ * lowest degree. A vertex u keeps only neighbors with degree >= deg(u), and there
+ * are at most 2E/deg(u) of those, so no vertex has more than O(sqrt(E)) outgoing edges.
+ */
+
+// Does vertex v (with degree deg_v) rank below vertex u (with degree deg_u)?
+static inline bool
+ranks_below(long v, long deg_v, long u, long deg_u)
+{
+    return deg_v < deg_u || (deg_v == deg_u && v < u);
+}
+
+// Keep the edges u->v in [begin, end) where u ranks below v
+// Returns the number of edges kept
+static long
+orient_edge_block(long u, long deg_u, vertex_id_t * begin, vertex_id_t * end, long * degree)
+{
+    vertex_id_t * out = begin;
+    for (vertex_id_t * e = begin; e < end; ++e) {
+        long v = *e;
+        if (ranks_below(u, deg_u, v, degree[v])) { *out++ = v; }
+    }
+    return out - begin;
+}
+
+static void
+copy_degree_worker(long * array, long begin, long end, va_list args)
+{
+    long * degree = array;
+    for (long v = begin; v < end; v += NODELETS()) {
+        degree[v] = G.vertex_out_degree[v];
+    }
+}
+
+static void
+orient_edges_worker(long * array, long begin, long end, va_list args)
+{
+    long * degree = array;
+    for (long u = begin; u < end; u += NODELETS()) {
+        long deg_u = degree[u];
+        if (is_heavy_out(u)) {
+            long num_kept = 0;
+            for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+                edge_block * eb = mw_get_nth(G.vertex_out_neighbors[u].repl_edge_block, nlet);
+                long n = orient_edge_block(u, deg_u, eb->edges, eb->edges + eb->num_edges, degree);
+                REMOTE_ADD((long*)mw_get_nth(&G.num_local_edges, nlet), n - eb->num_edges);
+                eb->num_edges = n;
+                num_kept += n;
+            }
+            G.vertex_out_degree[u] = num_kept;
+        } else {
+            vertex_id_t * edges = G.vertex_out_neighbors[u].local_edges;
+            long n = orient_edge_block(u, deg_u, edges, edges + deg_u, degree);
+            REMOTE_ADD(&G.num_local_edges, n - deg_u);
+            G.vertex_out_degree[u] = n;
+        }
+    }
+}
+
+void
+tc_orient_by_degree()
+{
+    assert(!G.is_oriented);
+    hooks_region_begin("tc_orient_by_degree");
+    // Segment offsets would point past the end of the compacted edge blocks
+    free_segment_storage();
+    // Ranks are based on the original degrees, which are overwritten as we go
+    long * degree;
+    init_striped_array(&degree, G.num_vertices);
+    emu_1d_array_apply(degree, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        copy_degree_worker
+    );
+    emu_1d_array_apply(degree, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        orient_edges_worker
+    );
+    // Keep the original degrees around for computing clustering coefficients
+    TC.undirected_degree = degree;
+    // Each edge is now stored once, minus the self loops that were dropped
+    long num_oriented_edges = 0;
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        num_oriented_edges += *(long*)mw_get_nth(&G.num_local_edges, nlet);
+    }
+    mw_replicated_init(&G.num_edges, num_oriented_edges);
+    mw_replicated_init(&G.is_oriented, 1);
+    hooks_region_end();
+}
+
+/**
+ * Set intersection
+ * Each triangle u->v->w is found by intersecting the neighbors w < v of v with
+ * the neighbors of u (or all the neighbors of v, if the graph is oriented by
+ * degree). Three strategies are available:
+ *   merge:     walk both lists together, O(deg(u) + deg(v))
+ *   galloping: for each w, exponential search forward through the neighbors of u,
+ *              O(deg(v) * log(deg(u) / deg(v))). Wins when deg(u) >> deg(v)
+ *   bitmap:    build a dense bitmap of the neighbors of u once, then test one
+ *              bit for each w, O(deg(v)). Shared by all the threads working on u.
+ *              Falls back to merge when the neighbors of u are spread too thin
+ * The adaptive strategy builds a bitmap for high-degree vertices whose
+ * neighbors are packed closely enough, and otherwise picks galloping or merge
+ * for each pair based on the ratio of the list sizes.
+ */
+
+// Neighbor lists of u that are this many times longer than those of v use galloping
+#define TC_GALLOPING_RATIO 32
+// Vertices with at least this many neighbors get a bitmap in adaptive mode...
+#define TC_BITMAP_MIN_DEGREE 256
+// ...as long as the bitmap has at most this many bits per neighbor (in any mode)
+#define TC_BITMAP_MAX_BITS_PER_NEIGHBOR 64
+
+/**
+ * Per-vertex triangle counts
+ * Each triangle u->v->w is found by a thread working on u, and must be credited
+ * to u, v and w. Both v and w are neighbors of u, so instead of doing a remote
+ * atomic for each triangle, the threads working on a light vertex u increment a
+ * local array with one counter for each neighbor of u. Once all the threads for u
+ * are done, each nonzero counter is added to the neighbor with a single remote
+ * atomic. Heavy vertices don't have a local list of neighbors, so the credits for
+ * w are sent as soon as each triangle is found.
+ */
+
+// Neighbors of u that can complete a triangle, and the bitmap built from them
+typedef struct tc_context {
+    tc_intersection intersection;
+    vertex_id_t * u_begin;
+    vertex_id_t * u_end;
+    // Bit (w - bits_first) is set if w is a neighbor of u, NULL if there is no bitmap
+    unsigned long * bits;
+    long bits_first;
+    long bits_last;
+    // Number of triangles found for each neighbor in [u_begin, u_end)
+    // NULL if per-vertex counts are disabled or u is heavy
+    long * counts;
+    // Per-vertex triangle counts (TC.vertex_triangles), NULL if disabled
+    long * vertex_triangles;
+} tc_context;
+
+// Credit the triangle to the neighbor of u at p_uw
+static inline void
+count_neighbor(long * counts, vertex_id_t * u_begin, vertex_id_t * p_uw)
+{
+    if (counts) { ATOMIC_ADDMS(&counts[p_uw - u_begin], 1); }
+}
+
+// Count the w's in [w_begin, w_end) that are also in [u_begin, u_end)
+static inline long
+intersect_merge(vertex_id_t * u_begin, vertex_id_t * u_end, vertex_id_t * w_begin, vertex_id_t * w_end,
+    long * counts)
+{
+    long num_found = 0;
+    vertex_id_t * p_uw = u_begin;
+    for (vertex_id_t * p_w = w_begin; p_w < w_end; ++p_w) {
+        long w = *p_w;
+        // Scan through neighbors of u, looking for w
+        while (p_uw < u_end && *p_uw < w) { p_uw++; }
+        if (p_uw == u_end) { break; }
+        if (*p_uw == w) {
+            ++num_found;
+            count_neighbor(counts, u_begin, p_uw);
+        }
+    }
+    return num_found;
+}
+
+static inline long
+intersect_galloping(vertex_id_t * u_begin, vertex_id_t * u_end, vertex_id_t * w_begin, vertex_id_t * w_end,
+    long * counts)
+{
+    long num_found = 0;
+    vertex_id_t * p_uw = u_begin;
+    for (vertex_id_t * p_w = w_begin; p_w < w_end; ++p_w) {
+        long w = *p_w;
+        // Double the step until we pass w, then binary search the last step
+        long step = 1;
+        long u_n = u_end - p_uw;
+        while (step < u_n && p_uw[step] < w) { step *= 2; }
+        vertex_id_t * last = step + 1 < u_n ? p_uw + step + 1 : u_end;
+        p_uw = lower_bound(p_uw + step / 2, last, w);
+        if (p_uw == u_end) { break; }
+        if (*p_uw == w) {
+            ++num_found;
+            count_neighbor(counts, u_begin, p_uw);
+        }
+    }
+    return num_found;
+}
+
+static inline long
+intersect_bitmap(const tc_context * ctx, vertex_id_t * w_begin, vertex_id_t * w_end)
+{
+    long num_found = 0;
+    const unsigned long * bits = ctx->bits;
+    const long first = ctx->bits_first;
+    const long last = ctx->bits_last;
+    for (vertex_id_t * p_w = w_begin; p_w < w_end; ++p_w) {
+        long w = *p_w;
+        if (w < first || w > last) { continue; }
+        long i = w - first;
+        if (bits[i >> 6] & (1UL << (i & 63))) {
+            ++num_found;
+            // The bitmap doesn't tell us where w is, search for it
+            if (ctx->counts) {
+                count_neighbor(ctx->counts, ctx->u_begin, lower_bound(ctx->u_begin, ctx->u_end, w));
+            }
+        }
+    }
+    return num_found;
+}
+
+// Look for triangles u->v->w, where w < v, using the edges v->w in [vw_begin, vw_end)
+static inline long
+count_triangles_in_block(long u, long v, vertex_id_t * vw_begin, vertex_id_t * vw_end, const tc_context * ctx)
+{
+    long num_triangles = 0;
+    // Once again, we limit ourselves to the neighbors of v that are less than v
+    // using a binary search. In an oriented graph, all the neighbors of v rank above v
+    if (!G.is_oriented) { vw_end = lower_bound(vw_begin, vw_end, v); }
+    if (is_heavy_out(u)) {
+        // The edges of u are split up by nodelet, look up each w separately
+        for (vertex_id_t * p_w = vw_begin; p_w < vw_end; ++p_w) {
+            if (has_edge(u, *p_w)) {
+                ++num_triangles;
+                if (ctx->vertex_triangles) { REMOTE_ADD(&ctx->vertex_triangles[*p_w], 1); }
+            }
+        }
+        return num_triangles;
+    }
+    // Pick a strategy
+    if (ctx->bits) {
+        return intersect_bitmap(ctx, vw_begin, vw_end);
+    }
+    long u_n = ctx->u_end - ctx->u_begin;
+    long w_n = vw_end - vw_begin;
+    if (ctx->intersection == TC_INTERSECT_GALLOPING || (ctx->intersection == TC_INTERSECT_ADAPTIVE
+        && u_n > TC_GALLOPING_RATIO * w_n)) {
+        return intersect_galloping(ctx->u_begin, ctx->u_end, vw_begin, vw_end, ctx->counts);
+    }
+    return intersect_merge(ctx->u_begin, ctx->u_end, vw_begin, vw_end, ctx->counts);
+}
+
 // Look for triangles with first side u->v, where v1 <= v < v2
 void
-count_triangles_worker(long u, long * v1, long * v2)
+count_triangles_worker(long u, vertex_id_t * v1, vertex_id_t * v2, const tc_context * ctx)
 {
     long num_triangles = 0;
-    for (long * p_v = v1; p_v < v2; ++p_v) {
+    for (vertex_id_t * p_v = v1; p_v < v2; ++p_v) {
         long v = *p_v;
+        long num_uv_triangles = 0;
         // At this point we have one side of the triangle, from u to v
         // For each edge v->w, see if we also have u->w to complete the triangle
-        long * vw_begin = G.vertex_out_neighbors[v].local_edges;
-        long * vw_end = vw_begin + G.vertex_out_degree[v];
-        // Once again, we limit ourselves to the neighbors of v that are less than v
-        // using a binary search
-        vw_end = lower_bound(vw_begin, vw_end, v);
-        // Iterator over edges of u
-        long * p_uw = G.vertex_out_neighbors[u].local_edges;
-        for (long * p_w = vw_begin; p_w < vw_end; ++p_w) {
-            // Now we have u->v and v->w
-            long w = *p_w;
-            // Scan through neighbors of u, looking for w
-            while (*p_uw < w) { p_uw++; } // TODO this could use lower_bound
-            if (w == *p_uw) {
-                // Found the triangle u->v->w
-                // LOG("Found triangle %li->%li->%li\n", u, v, w);
-                ++num_triangles;
+        if (is_heavy_out(v)) {
+            // Each edge block of v is sorted separately
+            for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+                edge_block * eb = mw_get_nth(G.vertex_out_neighbors[v].repl_edge_block, nlet);
+                num_uv_triangles += count_triangles_in_block(u, v, eb->edges, eb->edges + eb->num_edges, ctx);
             }
+        } else {
+            vertex_id_t * vw_begin = G.vertex_out_neighbors[v].local_edges;
+            vertex_id_t * vw_end = vw_begin + G.vertex_out_degree[v];
+            num_uv_triangles += count_triangles_in_block(u, v, vw_begin, vw_end, ctx);
         }
+        // Credit v with every triangle that has side u->v
+        if (num_uv_triangles && ctx->counts) {
+            ATOMIC_ADDMS(&ctx->counts[p_v - ctx->u_begin], num_uv_triangles);
+        } else if (num_uv_triangles && ctx->vertex_triangles) {
+            REMOTE_ADD(&ctx->vertex_triangles[v], num_uv_triangles);
+        }
+        num_triangles += num_uv_triangles;
     }
     REMOTE_ADD(&TC.num_triangles, num_triangles);
+    if (num_triangles && ctx->vertex_triangles) {
+        REMOTE_ADD(&ctx->vertex_triangles[u], num_triangles);
+    }
 }
 
-// Count triangles that start at vertex u
-void
-count_triangles(long u)
+// Count triangles with first side u->v, for each v in [v_begin, v_end)
+static void
+count_triangles_in_range(long u, vertex_id_t * v_begin, vertex_id_t * v_end, const tc_context * ctx)
 {
     long grain = 16;
 
     // Use binary search to find neighbors of u that are less than u.
-    long * v_begin = G.vertex_out_neighbors[u].local_edges;
-    long * v_end = v_begin + G.vertex_out_degree[u];
-    v_end = lower_bound(v_begin, v_end, u);
+    if (!G.is_oriented) { v_end = lower_bound(v_begin, v_end, u); }
     long v_n = v_end - v_begin;
     if (v_n <= grain) {
-        count_triangles_worker(u, v_begin, v_end);
+        count_triangles_worker(u, v_begin, v_end, ctx);
     } else {
-        for (long * v1 = v_begin; v1 < v_end; v1 += grain) {
-            long * v2 = v1 + grain;
+        for (vertex_id_t * v1 = v_begin; v1 < v_end; v1 += grain) {
+            vertex_id_t * v2 = v1 + grain;
             if (v2 > v_end) { v2 = v_end; }
-            cilk_spawn count_triangles_worker(u, v1, v2);
+            cilk_spawn count_triangles_worker(u, v1, v2, ctx);
+        }
+    }
+}
+
+// Calls count_triangles_in_range over a remote edge block
+void
+count_triangles_in_eb(long u, edge_block * eb, tc_intersection intersection, long * vertex_triangles)
+{
+    // Heavy vertices don't use the context, but it still selects the strategy for the edges of v
+    tc_context ctx;
+    ctx.intersection = intersection;
+    ctx.u_begin = ctx.u_end = NULL;
+    ctx.bits = NULL;
+    ctx.counts = NULL;
+    ctx.vertex_triangles = vertex_triangles;
+    count_triangles_in_range(u, eb->edges, eb->edges + eb->num_edges, &ctx);
+}
+
+// Should we build a bitmap of the neighbors of u in [u_begin, u_end)?
+static inline bool
+use_bitmap(tc_intersection intersection, vertex_id_t * u_begin, vertex_id_t * u_end)
+{
+    long u_n = u_end - u_begin;
+    if (u_n == 0) { return false; }
+    // A sparse bitmap could be as large as the whole vertex range, use merge instead
+    long range = *(u_end - 1) - *u_begin + 1;
+    if (range > TC_BITMAP_MAX_BITS_PER_NEIGHBOR * u_n) { return false; }
+    if (intersection == TC_INTERSECT_BITMAP) { return true; }
+    return intersection == TC_INTERSECT_ADAPTIVE && u_n >= TC_BITMAP_MIN_DEGREE;
+}
+
+// Set up the context for a light vertex u: find the neighbors that can complete
+// a triangle, and allocate the bitmap and per-neighbor counts if needed
+static void
+init_light_context(tc_context * ctx, long u, tc_intersection intersection, long * vertex_triangles)
+{
+    vertex_id_t * v_begin = G.vertex_out_neighbors[u].local_edges;
+    vertex_id_t * v_end = v_begin + G.vertex_out_degree[u];
+    // Only the neighbors of u that are less than u can complete a triangle
+    ctx->intersection = intersection;
+    ctx->u_begin = v_begin;
+    ctx->u_end = G.is_oriented ? v_end : lower_bound(v_begin, v_end, u);
+    ctx->bits = NULL;
+    ctx->counts = NULL;
+    ctx->vertex_triangles = vertex_triangles;
+    long u_n = ctx->u_end - ctx->u_begin;
+    if (vertex_triangles && u_n > 0) {
+        ctx->counts = mw_localmalloc(u_n * sizeof(long), v_begin);
+        assert(ctx->counts);
+        memset(ctx->counts, 0, u_n * sizeof(long));
+    }
+    if (use_bitmap(intersection, ctx->u_begin, ctx->u_end)) {
+        ctx->bits_first = *ctx->u_begin;
+        ctx->bits_last = *(ctx->u_end - 1);
+        long num_words = ((ctx->bits_last - ctx->bits_first) >> 6) + 1;
+        ctx->bits = mw_localmalloc(num_words * sizeof(unsigned long), v_begin);
+        assert(ctx->bits);
+        memset(ctx->bits, 0, num_words * sizeof(unsigned long));
+        for (vertex_id_t * e = ctx->u_begin; e < ctx->u_end; ++e) {
+            long i = *e - ctx->bits_first;
+            ctx->bits[i >> 6] |= 1UL << (i & 63);
         }
     }
 }
 
+// Free the bitmap, and send the credits for each neighbor of u
+// All the threads using the context must be done
+static void
+finish_light_context(tc_context * ctx)
+{
+    if (ctx->bits) { mw_localfree(ctx->bits); }
+    if (ctx->counts) {
+        long u_n = ctx->u_end - ctx->u_begin;
+        for (long i = 0; i < u_n; ++i) {
+            if (ctx->counts[i]) { REMOTE_ADD(&ctx->vertex_triangles[ctx->u_begin[i]], ctx->counts[i]); }
+        }
+        mw_localfree(ctx->counts);
+    }
+}
+
+// Count triangles that start at vertex u
+void
+count_triangles(long u, tc_intersection intersection, long * vertex_triangles)
+{
+    if (is_heavy_out(u)) {
+        // Heavy vertex, spawn a thread for each remote edge block
+        edge_block * eb = G.vertex_out_neighbors[u].repl_edge_block;
+        for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+            edge_block * remote_eb = get_nth(eb, nlet);
+            cilk_spawn_at(remote_eb) count_triangles_in_eb(u, remote_eb, intersection, vertex_triangles);
+        }
+    } else {
+        vertex_id_t * v_begin = G.vertex_out_neighbors[u].local_edges;
+        vertex_id_t * v_end = v_begin + G.vertex_out_degree[u];
+        tc_context ctx;
+        init_light_context(&ctx, u, intersection, vertex_triangles);
+        count_triangles_in_range(u, v_begin, v_end, &ctx);
+        // count_triangles_in_range() syncs before returning, so the context is no longer in use
+        finish_light_context(&ctx);
+    }
+}
+
 void
 count_triangles_spawner(long * array, long begin, long end, va_list args)
 {
+    tc_intersection intersection = (tc_intersection)va_arg(args, long);
+    long * vertex_triangles = va_arg(args, long*);
     for (long u = begin; u < end; u += NODELETS()) {
-        count_triangles(u);
+        count_triangles(u, intersection, vertex_triangles);
     }
 }
 
-long
-tc_run()
+/**
+ * Work-balanced scheduling
+ * Scheduling by vertex gives each u a thread, but the work for u is the sum of
+ * the degrees of its neighbors, which varies wildly on power-law graphs. A few
+ * hubs finish last, and so do the nodelets they live on.
+ *
+ * Overview of plan_work_units()
+ *   spawn estimate_work_worker() over all vertices
+ *     estimate the work for u as the sum of (degree + 1) over the neighbors v of u
+ *     that can complete a triangle
+ *   pick a target work size, so that each nodelet gets about
+ *   TC_UNITS_PER_NODELET units
+ *   spawn count_work_units_worker() over all vertices
+ *     cut the neighbors of u into ranges of about the target size, and count
+ *     them on the nodelet where the range is stored
+ *   allocate a queue of work units on each nodelet
+ *   spawn fill_work_units_worker() over all vertices
+ *     cut the ranges again, and append them to the local queue
+ *     light vertices that are cut into several units get a shared context
+ *
+ * Overview of run_work_units()
+ *   spawn init_shared_contexts_spawner() on each nodelet
+ *     build each shared context once, and set its refcount to the number of units
+ *   spawn TC_WORKERS_PER_NODELET workers on each nodelet
+ *     pop units from the local queue until it is empty
+ *     then steal units from the queues on the other nodelets
+ *     the last unit to finish with a shared context flushes and frees it
+ *
+ * Sharing the context keeps the cost of the bitmap and the per-neighbor counts
+ * at O(deg(u)) per vertex, and one remote atomic per neighbor, no matter how
+ * many units u is cut into.
+ */
+
+// Context shared by all the work units of a light vertex
+typedef struct tc_shared_context {
+    tc_context ctx;
+    // Total number of units for the vertex
+    long num_units;
+    // Number of units that haven't finished yet in this run
+    long refcount;
+} tc_shared_context;
+
+typedef struct tc_work_unit {
+    long u;
+    // Neighbors of u to use as the second vertex v of each triangle
+    vertex_id_t * v_begin;
+    vertex_id_t * v_end;
+    // Shared by all the units of a light vertex, NULL if u has only one unit or is heavy
+    tc_shared_context * shared;
+} tc_work_unit;
+
+typedef struct tc_work_queue {
+    // Local array of work units
+    tc_work_unit * units;
+    long num_units;
+    // Index of the next unit to run (or fill, while planning)
+    long head;
+    // Estimated work for all the units in the queue
+    long work;
+} tc_work_queue;
+
+// One queue of work units on each nodelet
+replicated tc_work_queue TC_QUEUE;
+
+// Aim for this many work units on each nodelet, so there are plenty to steal
+#define TC_UNITS_PER_NODELET 1024
+// Number of threads that pull work units from the queues on each nodelet
+#define TC_WORKERS_PER_NODELET 64
+
+// Estimated cost of the intersections for the edge u->v
+static inline long
+edge_work(long v)
+{
+    return G.vertex_out_degree[v] + 1;
+}
+
+// Neighbors of u in [begin, end) that can complete a triangle
+static inline vertex_id_t *
+triangle_neighbors_end(long u, vertex_id_t * begin, vertex_id_t * end)
+{
+    return G.is_oriented ? end : lower_bound(begin, end, u);
+}
+
+static long
+range_work(vertex_id_t * begin, vertex_id_t * end)
+{
+    long work = 0;
+    for (vertex_id_t * p = begin; p < end; ++p) {
+        work += edge_work(*p);
+    }
+    return work;
+}
+
+// Cut [begin, end) into units of about target_work, and count them in the queue
+// local to the edges. If fill is set, also append the units to the queue
+// If shared is not NULL, it is attached to each unit
+static void
+cut_work_units(long u, vertex_id_t * begin, vertex_id_t * end, long work, long target_work, bool fill,
+    tc_shared_context * shared)
+{
+    if (begin == end) { return; }
+    tc_work_queue * queue = mw_get_localto(&TC_QUEUE, begin);
+    vertex_id_t * unit_begin = begin;
+    long unit_work = 0;
+    long num_units = 0;
+    for (vertex_id_t * p = begin; p < end; ++p) {
+        // Small ranges always make a single unit, no need to look at each edge
+        if (work < target_work) {
+            p = end - 1;
+            unit_work = work;
+        } else {
+            unit_work += edge_work(*p);
+        }
+        if (unit_work >= target_work || p == end - 1) {
+            if (fill) {
+                long pos = ATOMIC_ADDMS(&queue->head, 1);
+                assert(pos < queue->num_units);
+                queue->units[pos].u = u;
+                queue->units[pos].v_begin = unit_begin;
+                queue->units[pos].v_end = p + 1;
+                queue->units[pos].shared = shared;
+                REMOTE_ADD(&queue->work, unit_work);
+            } else {
+                REMOTE_ADD(&queue->num_units, 1);
+            }
+            unit_begin = p + 1;
+            unit_work = 0;
+            num_units += 1;
+        }
+    }
+    if (shared) { shared->num_units = num_units; }
+}
+
+static void
+estimate_work_worker(long * array, long begin, long end, long * sum, va_list args)
+{
+    long * work = array;
+    long local_sum = 0;
+    for (long u = begin; u < end; u += NODELETS()) {
+        long w = 0;
+        if (is_heavy_out(u)) {
+            for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+                edge_block * eb = mw_get_nth(G.vertex_out_neighbors[u].repl_edge_block, nlet);
+                vertex_id_t * eb_end = eb->edges + eb->num_edges;
+                w += range_work(eb->edges, triangle_neighbors_end(u, eb->edges, eb_end));
+            }
+        } else {
+            vertex_id_t * v_begin = G.vertex_out_neighbors[u].local_edges;
+            vertex_id_t * v_end = v_begin + G.vertex_out_degree[u];
+            w = range_work(v_begin, triangle_neighbors_end(u, v_begin, v_end));
+        }
+        work[u] = w;
+        local_sum += w;
+    }
+    REMOTE_ADD(sum, local_sum);
+}
+
+static void
+cut_work_units_worker(long * array, long begin, long end, va_list args)
+{
+    long * work = array;
+    long target_work = va_arg(args, long);
+    bool fill = (bool)va_arg(args, long);
+    for (long u = begin; u < end; u += NODELETS()) {
+        if (work[u] == 0) { continue; }
+        if (is_heavy_out(u)) {
+            // Each edge block goes in the queue on its own nodelet
+            for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+                edge_block * eb = mw_get_nth(G.vertex_out_neighbors[u].repl_edge_block, nlet);
+                vertex_id_t * eb_end = triangle_neighbors_end(u, eb->edges, eb->edges + eb->num_edges);
+                // Don't know how the work is split between blocks, so cut each one by edge
+                cut_work_units(u, eb->edges, eb_end, target_work, target_work, fill, NULL);
+            }
+        } else {
+            vertex_id_t * v_begin = G.vertex_out_neighbors[u].local_edges;
+            vertex_id_t * v_end = triangle_neighbors_end(u, v_begin, v_begin + G.vertex_out_degree[u]);
+            // Vertices with more work than the target will be cut into several units
+            tc_shared_context * shared = NULL;
+            if (fill && work[u] >= target_work) {
+                shared = mw_localmalloc(sizeof(tc_shared_context), v_begin);
+                assert(shared);
+            }
+            cut_work_units(u, v_begin, v_end, work[u], target_work, fill, shared);
+        }
+    }
+}
+
+static void
+plan_work_units()
 {
-    emu_1d_array_apply(G.vertex_out_degree, G.num_vertices, 1,
-        count_triangles_spawner
+    hooks_region_begin("tc_plan_work_units");
+    long * work;
+    init_striped_array(&work, G.num_vertices);
+    long total_work = emu_1d_array_reduce_sum(work, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        estimate_work_worker
+    );
+    long target_work = total_work / (NODELETS() * TC_UNITS_PER_NODELET);
+    if (target_work < 1) { target_work = 1; }
+
+    // Count the units on each nodelet, so we can allocate the queues
+    mw_replicated_init(&TC_QUEUE.num_units, 0);
+    mw_replicated_init(&TC_QUEUE.head, 0);
+    mw_replicated_init(&TC_QUEUE.work, 0);
+    emu_1d_array_apply(work, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        cut_work_units_worker, target_work, (long)false
+    );
+    long num_units = 0;
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        tc_work_queue * queue = mw_get_nth(&TC_QUEUE, nlet);
+        queue->units = mw_localmalloc((queue->num_units + 1) * sizeof(tc_work_unit), queue);
+        if (queue->units == NULL) {
+            LOG("Failed to allocate work queue on nodelet %li\n", nlet);
+            exit(1);
+        }
+        num_units += queue->num_units;
+    }
+    // Cut the units again, this time storing them in the queues
+    emu_1d_array_apply(work, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 64),
+        cut_work_units_worker, target_work, (long)true
     );
+    mw_free(work);
+    hooks_region_end();
+
+    // Report how evenly the work is spread before stealing
+    long max_work = 0;
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        tc_work_queue * queue = mw_get_nth(&TC_QUEUE, nlet);
+        assert(queue->head == queue->num_units);
+        if (queue->work > max_work) { max_work = queue->work; }
+    }
+    LOG("Planned %li work units with target work %li, busiest nodelet has %3.2fx the average work\n",
+        num_units, target_work, total_work ? (double)max_work * NODELETS() / total_work : 0.0);
+}
+
+// Is this the first unit of a vertex with a shared context?
+static inline bool
+owns_shared_context(tc_work_unit * unit)
+{
+    return unit->shared && unit->v_begin == G.vertex_out_neighbors[unit->u].local_edges;
+}
+
+static void
+free_work_units()
+{
+    if (TC_QUEUE.units == NULL) { return; }
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        tc_work_queue * queue = mw_get_nth(&TC_QUEUE, nlet);
+        for (long i = 0; i < queue->num_units; ++i) {
+            if (owns_shared_context(&queue->units[i])) { mw_localfree(queue->units[i].shared); }
+        }
+        mw_localfree(queue->units);
+        queue->units = NULL;
+        queue->num_units = 0;
+    }
+}
+
+static void
+run_work_unit(tc_work_unit * unit, tc_intersection intersection, long * vertex_triangles)
+{
+    long u = unit->u;
+    tc_context ctx;
+    if (is_heavy_out(u)) {
+        // Same as count_triangles_in_eb(), the context only selects the strategy
+        ctx.intersection = intersection;
+        ctx.u_begin = ctx.u_end = NULL;
+        ctx.bits = NULL;
+        ctx.counts = NULL;
+        ctx.vertex_triangles = vertex_triangles;
+        count_triangles_worker(u, unit->v_begin, unit->v_end, &ctx);
+    } else if (unit->shared) {
+        tc_shared_context * shared = unit->shared;
+        count_triangles_worker(u, unit->v_begin, unit->v_end, &shared->ctx);
+        // The last unit to finish sends the credits for the whole vertex
+        if (ATOMIC_ADDMS(&shared->refcount, -1) == 1) {
+            finish_light_context(&shared->ctx);
+        }
+    } else {
+        init_light_context(&ctx, u, intersection, vertex_triangles);
+        count_triangles_worker(u, unit->v_begin, unit->v_end, &ctx);
+        finish_light_context(&ctx);
+    }
+}
+
+static void
+init_shared_context(tc_shared_context * shared, long u, tc_intersection intersection, long * vertex_triangles)
+{
+    init_light_context(&shared->ctx, u, intersection, vertex_triangles);
+    shared->refcount = shared->num_units;
+}
+
+static void
+init_shared_contexts_spawner(long nlet, tc_intersection intersection, long * vertex_triangles)
+{
+    tc_work_queue * queue = mw_get_nth(&TC_QUEUE, nlet);
+    for (long i = 0; i < queue->num_units; ++i) {
+        tc_work_unit * unit = &queue->units[i];
+        if (owns_shared_context(unit)) {
+            cilk_spawn init_shared_context(unit->shared, unit->u, intersection, vertex_triangles);
+        }
+    }
+}
+
+static void
+work_units_worker(long nlet, tc_intersection intersection, long * vertex_triangles)
+{
+    // Start with the local queue, then steal from the other nodelets in turn
+    for (long i = 0; i < NODELETS(); ++i) {
+        tc_work_queue * queue = mw_get_nth(&TC_QUEUE, (nlet + i) % NODELETS());
+        long num_units = queue->num_units;
+        while (true) {
+            long pos = ATOMIC_ADDMS(&queue->head, 1);
+            if (pos >= num_units) { break; }
+            run_work_unit(&queue->units[pos], intersection, vertex_triangles);
+        }
+    }
+}
+
+static void
+work_units_spawner(long nlet, tc_intersection intersection, long * vertex_triangles)
+{
+    for (long t = 0; t < TC_WORKERS_PER_NODELET; ++t) {
+        cilk_spawn work_units_worker(nlet, intersection, vertex_triangles);
+    }
+}
+
+static void
+run_work_units(tc_intersection intersection)
+{
+    // The bitmaps depend on the intersection strategy, so shared contexts are rebuilt for each run
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        cilk_spawn_at(mw_get_nth(&TC_QUEUE, nlet)) init_shared_contexts_spawner(nlet, intersection, TC.vertex_triangles);
+    }
+    cilk_sync;
+    mw_replicated_init(&TC_QUEUE.head, 0);
+    for (long nlet = 0; nlet < NODELETS(); ++nlet) {
+        cilk_spawn_at(mw_get_nth(&TC_QUEUE, nlet)) work_units_spawner(nlet, intersection, TC.vertex_triangles);
+    }
+    cilk_sync;
+}
+
+long
+tc_run(tc_intersection intersection)
+{
+    if (TC.balanced) {
+        run_work_units(intersection);
+    } else {
+        emu_1d_array_apply(G.vertex_out_degree, G.num_vertices, 1,
+            count_triangles_spawner, (long)intersection, TC.vertex_triangles
+        );
+    }
     return TC.num_triangles;
 }
 
+// Degree of v in the undirected graph, before orientation
+static inline long
+undirected_degree(long v)
+{
+    return TC.undirected_degree ? TC.undirected_degree[v] : G.vertex_out_degree[v];
+}
+
+double
+tc_local_clustering_coefficient(long v)
+{
+    assert(TC.vertex_triangles);
+    long degree = undirected_degree(v);
+    if (degree < 2) { return 0; }
+    return 2.0 * TC.vertex_triangles[v] / ((double)degree * (degree - 1));
+}
+
+static void
+count_wedges_worker(long * array, long begin, long end, long * sum, va_list args)
+{
+    long * degree = array;
+    long local_sum = 0;
+    for (long v = begin; v < end; v += NODELETS()) {
+        local_sum += degree[v] * (degree[v] - 1) / 2;
+    }
+    REMOTE_ADD(sum, local_sum);
+}
+
+double
+tc_transitivity()
+{
+    long * degree = TC.undirected_degree ? TC.undirected_degree : G.vertex_out_degree;
+    long num_wedges = emu_1d_array_reduce_sum(degree, G.num_vertices, GLOBAL_GRAIN_MIN(G.num_vertices, 256),
+        count_wedges_worker
+    );
+    if (num_wedges == 0) { return 0; }
+    return 3.0 * TC.num_triangles / num_wedges;
+}
+
+void
+tc_write_vertex_triangles(FILE * fp)
+{
+    assert(TC.vertex_triangles);
+    for (long v = 0; v < G.num_vertices; ++v) {
+        // Use the vertex ID's from the input file
+        fprintf(fp, "%li %li %f\n", relabel_get_old_id(v), TC.vertex_triangles[v],
+            tc_local_clustering_coefficient(v));
+    }
+}
 
 // Do serial triangle count
 bool
@@ -124,25 +927,36 @@ tc_check()
 {
     // Do a serial triangle count
     long correct_num_triangles = 0;
+    long * correct_vertex_triangles = NULL;
+    if (TC.vertex_triangles) {
+        correct_vertex_triangles = calloc(G.num_vertices, sizeof(long));
+        assert(correct_vertex_triangles);
+    }
 
     // For all vertices...
     for (long u = 0; u < G.num_vertices; ++u) {
         // For v in u.neighbors, where u > v...
         cursor cu;
         for (cursor_init_out(&cu, u); cursor_valid(&cu); cursor_next(&cu)) {
-            long v = *cu.e;
-            if (v > u) break;
-            cursor cu2; cursor_init_out(&cu2, u);
+            long v = cursor_get(&cu);
+            // Edges of heavy vertices are only sorted within each edge block,
+            // so we can't stop early
+            // In an oriented graph, all the neighbors of u rank above u
+            if (!G.is_oriented && v > u) continue;
             // For w in v.neighbors, where v > w...
             cursor cv;
             for (cursor_init_out(&cv, v); cursor_valid(&cv); cursor_next(&cv)) {
-                long w = *cv.e;
-                if (w > v) break;
-                // Scan through u.neighbors, looking for w
-                while (*cu2.e < w) { cursor_next(&cu2); }
-                if (w == *cu2.e) {
+                long w = cursor_get(&cv);
+                if (!G.is_oriented && w > v) continue;
+                // Search u.neighbors for w
+                if (has_edge(u, w)) {
                     // LOG("Found triangle %li->%li->%li\n", u, v, w);
                     correct_num_triangles += 1;
+                    if (correct_vertex_triangles) {
+                        correct_vertex_triangles[u] += 1;
+                        correct_vertex_triangles[v] += 1;
+                        correct_vertex_triangles[w] += 1;
+                    }
                 }
             }
         }
@@ -153,5 +967,16 @@ tc_check()
     if (!success) {
         LOG("Should have found %li triangles\n", correct_num_triangles);
     }
+    if (correct_vertex_triangles) {
+        for (long v = 0; v < G.num_vertices; ++v) {
+            if (TC.vertex_triangles[v] != correct_vertex_triangles[v]) {
+                LOG("Vertex %li should be part of %li triangles, not %li\n",
+                    v, correct_vertex_triangles[v], TC.vertex_triangles[v]);
+                success = false;
+                break;
+            }
+        }
+        free(correct_vertex_triangles);
+    }
     return success;
 }
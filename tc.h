@@ -1,16 +1,45 @@
 #include "graph.h"
 
+#include <stdio.h>
+
 typedef struct tc_data {
-    // Number of triangles this vertex is a part of
+    // Total number of triangles in the graph
     long num_triangles;
+    // Striped array, number of triangles each vertex is a part of
+    // NULL unless per-vertex counts were requested in tc_init()
+    long * vertex_triangles;
+    // Striped array, degree of each vertex before tc_orient_by_degree()
+    // NULL if the graph was not oriented
+    long * undirected_degree;
+    // Run balanced work units from per-nodelet queues instead of one thread per vertex
+    bool balanced;
 } tc_data;
 
 // Global replicated struct with BFS data pointers
 extern tc_data TC;
 
-void tc_init();
-long tc_run();
+// Strategy for intersecting the neighbor lists of two vertices
+typedef enum tc_intersection {
+    TC_INTERSECT_ADAPTIVE,
+    TC_INTERSECT_MERGE,
+    TC_INTERSECT_GALLOPING,
+    TC_INTERSECT_BITMAP,
+} tc_intersection;
+
+// If per_vertex is set, tc_run() also counts the triangles of each vertex
+// If balanced is set, the work is cut into units of similar size up front, and
+// tc_run() runs them from a queue on each nodelet, stealing when the local queue is empty
+void tc_init(bool per_vertex, bool balanced);
+long tc_run(tc_intersection intersection);
+// Keep only the edges u->v where v has higher (degree, id) rank than u
+void tc_orient_by_degree();
 void tc_data_clear();
+// Fraction of the pairs of neighbors of v that are connected (requires per-vertex counts)
+double tc_local_clustering_coefficient(long v);
+// Fraction of all connected triples that are closed: 3 * num_triangles / num_wedges
+double tc_transitivity();
+// Write "vertex_id num_triangles clustering_coefficient" for each vertex
+void tc_write_vertex_triangles(FILE * fp);
 bool tc_check();
 void tc_deinit();
 
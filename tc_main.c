@@ -4,12 +4,24 @@
 
 #include "load_edge_list.h"
 #include "graph_from_edge_list.h"
+#include "graph_snapshot.h"
+#include "relabel.h"
 #include "tc.h"
 
 const struct option long_options[] = {
     {"graph_filename"   , required_argument},
     {"distributed_load" , no_argument},
+    {"save_graph"       , required_argument},
+    {"load_graph"       , required_argument},
+    {"sort_construction", no_argument},
+    {"relabel"          , no_argument},
+    {"heavy_threshold"  , required_argument},
     {"num_trials"       , required_argument},
+    {"intersection"     , required_argument},
+    {"orient_by_degree" , no_argument},
+    {"per_vertex"       , no_argument},
+    {"balance_work"     , no_argument},
+    {"per_vertex_file"  , required_argument},
     {"dump_edge_list"   , no_argument},
     {"check_graph"      , no_argument},
     {"dump_graph"       , no_argument},
@@ -24,7 +36,18 @@ print_help(const char* argv0)
     LOG( "Usage: %s [OPTIONS]\n", argv0);
     LOG("\t--graph_filename     Path to graph file to load\n");
     LOG("\t--distributed_load   Load the graph from all nodes at once (File must exist on all nodes, use absolute path).\n");
+    LOG("\t--save_graph         Save the constructed graph to this file\n");
+    LOG("\t--load_graph         Load a graph saved with --save_graph, instead of constructing it from --graph_filename\n");
+    LOG("\t--sort_construction  Construct the graph by sorting edges on each nodelet, instead of with remote atomics\n");
+    LOG("\t--relabel            Renumber vertices so that neighbors are more likely to be on the same nodelet\n");
+    LOG("\t--heavy_threshold    Vertices with this many neighbors will be spread across nodelets\n");
     LOG("\t--num_trials         Run BFS this many times.\n");
+    LOG("\t--intersection       Set intersection strategy: adaptive (default), merge, galloping, bitmap,\n");
+    LOG("\t                     or all to run each strategy in turn and compare their times\n");
+    LOG("\t--orient_by_degree   Before counting, store each edge only at the endpoint with the lower degree\n");
+    LOG("\t--per_vertex         Also count the triangles of each vertex, and compute clustering coefficients\n");
+    LOG("\t--per_vertex_file    Write the triangle count and clustering coefficient of each vertex to this file (implies --per_vertex)\n");
+    LOG("\t--balance_work       Cut the work into units of similar size, and run them from per-nodelet queues with stealing\n");
     LOG("\t--dump_edge_list     Print the edge list to stdout after loading (slow)\n");
     LOG("\t--check_graph        Validate the constructed graph against the edge list (slow)\n");
     LOG("\t--dump_graph         Print the graph to stdout after construction (slow)\n");
@@ -35,7 +58,17 @@ print_help(const char* argv0)
 typedef struct tc_args {
     const char* graph_filename;
     bool distributed_load;
+    const char* save_graph;
+    const char* load_graph;
+    bool sort_construction;
+    bool relabel;
+    long heavy_threshold;
     long num_trials;
+    const char* intersection;
+    bool orient_by_degree;
+    bool per_vertex;
+    const char* per_vertex_file;
+    bool balance_work;
     bool dump_edge_list;
     bool check_graph;
     bool dump_graph;
@@ -48,7 +81,17 @@ parse_args(int argc, char *argv[])
     tc_args args;
     args.graph_filename = NULL;
     args.distributed_load = false;
+    args.save_graph = NULL;
+    args.load_graph = NULL;
+    args.sort_construction = false;
+    args.relabel = false;
+    args.heavy_threshold = LONG_MAX;
     args.num_trials = 1;
+    args.intersection = "adaptive";
+    args.orient_by_degree = false;
+    args.per_vertex = false;
+    args.per_vertex_file = NULL;
+    args.balance_work = false;
     args.dump_edge_list = false;
     args.check_graph = false;
     args.dump_graph = false;
@@ -72,8 +115,29 @@ parse_args(int argc, char *argv[])
             args.graph_filename = optarg;
         } else if (!strcmp(option_name, "distributed_load")) {
             args.distributed_load = true;
+        } else if (!strcmp(option_name, "save_graph")) {
+            args.save_graph = optarg;
+        } else if (!strcmp(option_name, "load_graph")) {
+            args.load_graph = optarg;
+        } else if (!strcmp(option_name, "sort_construction")) {
+            args.sort_construction = true;
+        } else if (!strcmp(option_name, "relabel")) {
+            args.relabel = true;
+        } else if (!strcmp(option_name, "heavy_threshold")) {
+            args.heavy_threshold = atol(optarg);
         } else if (!strcmp(option_name, "num_trials")) {
             args.num_trials = atol(optarg);
+        } else if (!strcmp(option_name, "intersection")) {
+            args.intersection = optarg;
+        } else if (!strcmp(option_name, "orient_by_degree")) {
+            args.orient_by_degree = true;
+        } else if (!strcmp(option_name, "per_vertex")) {
+            args.per_vertex = true;
+        } else if (!strcmp(option_name, "per_vertex_file")) {
+            args.per_vertex_file = optarg;
+            args.per_vertex = true;
+        } else if (!strcmp(option_name, "balance_work")) {
+            args.balance_work = true;
         } else if (!strcmp(option_name, "dump_edge_list")) {
             args.dump_edge_list = true;
         } else if (!strcmp(option_name, "check_graph")) {
@@ -87,11 +151,39 @@ parse_args(int argc, char *argv[])
             exit(1);
         }
     }
-    if (args.graph_filename == NULL) { LOG( "Missing graph filename\n"); exit(1); }
+    if (args.load_graph != NULL) {
+        // There is no edge list when loading a saved graph
+        if (args.dump_edge_list || args.check_graph) {
+            LOG( "dump_edge_list and check_graph can't be used with load_graph\n"); exit(1);
+        }
+        if (args.relabel) {
+            LOG( "relabel can't be used with load_graph\n"); exit(1);
+        }
+    } else if (args.graph_filename == NULL) { LOG( "Missing graph filename\n"); exit(1); }
     if (args.num_trials <= 0) { LOG( "num_trials must be > 0\n"); exit(1); }
+    if (args.heavy_threshold <= 0) { LOG( "heavy_threshold must be > 0\n"); exit(1); }
+    if (args.sort_construction && args.heavy_threshold != LONG_MAX) {
+        LOG( "heavy_threshold can't be used with sort_construction\n"); exit(1);
+    }
+    // Snapshots store each edge block as a local array
+    if (args.save_graph && args.heavy_threshold != LONG_MAX) {
+        LOG( "heavy_threshold can't be used with save_graph\n"); exit(1);
+    }
+    // Snapshots don't store the mapping back to the vertex ID's in the input file
+    if (args.save_graph && args.relabel) {
+        LOG( "relabel can't be used with save_graph\n"); exit(1);
+    }
     return args;
 }
 
+static const char* intersection_names[] = {
+    [TC_INTERSECT_ADAPTIVE] = "adaptive",
+    [TC_INTERSECT_MERGE] = "merge",
+    [TC_INTERSECT_GALLOPING] = "galloping",
+    [TC_INTERSECT_BITMAP] = "bitmap",
+};
+#define NUM_INTERSECTIONS (sizeof(intersection_names) / sizeof(intersection_names[0]))
+
 int
 main(int argc, char ** argv)
 {
@@ -103,23 +195,53 @@ main(int argc, char ** argv)
 
     // Parse command-line argumetns
     tc_args args = parse_args(argc, argv);
+    hooks_set_attr_i64("heavy_threshold", args.heavy_threshold);
+
+    // Open the output file now, rather than finding out it's not writable after all the trials
+    FILE * per_vertex_fp = NULL;
+    if (args.per_vertex_file) {
+        per_vertex_fp = fopen(args.per_vertex_file, "w");
+        if (per_vertex_fp == NULL) {
+            LOG("Unable to open %s for writing\n", args.per_vertex_file);
+            exit(1);
+        }
+    }
 
-    // Load the edge list
-    if (args.distributed_load) {
-        load_edge_list_distributed(args.graph_filename);
+    if (args.load_graph) {
+        // Load the graph that was saved by a previous run
+        if (!load_graph_snapshot(args.load_graph)) {
+            LOG("Sorting edge blocks...\n");
+            sort_edge_blocks();
+        }
     } else {
-        load_edge_list(args.graph_filename);
+        // Load the edge list
+        if (args.distributed_load) {
+            load_edge_list_distributed(args.graph_filename);
+        } else {
+            load_edge_list(args.graph_filename);
+        }
+        if (args.dump_edge_list) {
+            LOG("Dumping edge list...\n");
+            dump_edge_list();
+        }
+        if (args.relabel) {
+            relabel_edge_list_bfs();
+        }
+
+        // Build the graph
+        LOG("Constructing graph...\n");
+        if (args.sort_construction) {
+            // Edge blocks are already sorted
+            construct_graph_from_edge_list_by_sorting();
+        } else {
+            construct_graph_from_edge_list(args.heavy_threshold);
+            LOG("Sorting edge blocks...\n");
+            sort_edge_blocks();
+        }
     }
-    if (args.dump_edge_list) {
-        LOG("Dumping edge list...\n");
-        dump_edge_list();
+    if (args.save_graph) {
+        save_graph_snapshot(args.save_graph, true);
     }
-
-    // Build the graph
-    LOG("Constructing graph...\n");
-    construct_graph_from_edge_list(LONG_MAX); // No heavy vertices for TC
-    LOG("Sorting edge blocks...\n");
-    sort_edge_blocks();
     print_graph_distribution();
     hooks_set_attr_i64("num_undirected_edges", G.num_edges/2);
     hooks_set_attr_i64("num_vertices", G.num_vertices);
@@ -136,31 +258,87 @@ main(int argc, char ** argv)
         dump_graph();
     }
 
+    hooks_set_attr_i64("orient_by_degree", args.orient_by_degree);
+    if (args.orient_by_degree) {
+        LOG("Orienting edges by degree...\n");
+        tc_orient_by_degree();
+    }
+
+    // Choose the intersection strategies to run
+    long first_intersection, last_intersection;
+    if (!strcmp(args.intersection, "all")) {
+        first_intersection = 0;
+        last_intersection = NUM_INTERSECTIONS - 1;
+    } else {
+        first_intersection = -1;
+        for (long i = 0; i < NUM_INTERSECTIONS; ++i) {
+            if (!strcmp(args.intersection, intersection_names[i])) {
+                first_intersection = i;
+            }
+        }
+        if (first_intersection < 0) {
+            LOG("Intersection '%s' not implemented!\n", args.intersection);
+            exit(1);
+        }
+        last_intersection = first_intersection;
+    }
+
     // Initialize the algorithm
     LOG("Initializing TC data structures...\n");
-    tc_init();
-
-    for (long trial = 0; trial < args.num_trials; ++trial) {
-        LOG("Counting triangles (trial %li of %li)\n",
-            trial + 1, args.num_trials);
-        // Run the triangle count
-        hooks_region_begin("tc");
-        tc_run();
-        double time_ms = hooks_region_end();
-        if (args.check_results) {
-            LOG("Checking results...\n");
-            if (tc_check()) {
-                LOG("PASS\n");
-            } else {
-                LOG("FAIL\n");
+    hooks_set_attr_i64("per_vertex", args.per_vertex);
+    hooks_set_attr_i64("balance_work", args.balance_work);
+    tc_init(args.per_vertex, args.balance_work);
+
+    double mean_time_ms[NUM_INTERSECTIONS];
+    for (long i = first_intersection; i <= last_intersection; ++i) {
+        tc_intersection intersection = (tc_intersection)i;
+        hooks_set_attr_str("intersection", intersection_names[i]);
+        double total_time_ms = 0;
+        for (long trial = 0; trial < args.num_trials; ++trial) {
+            LOG("Counting triangles with %s intersection (trial %li of %li)\n",
+                intersection_names[i], trial + 1, args.num_trials);
+            // Run the triangle count
+            hooks_region_begin("tc");
+            tc_run(intersection);
+            double time_ms = hooks_region_end();
+            total_time_ms += time_ms;
+            if (args.check_results) {
+                LOG("Checking results...\n");
+                if (tc_check()) {
+                    LOG("PASS\n");
+                } else {
+                    LOG("FAIL\n");
+                }
             }
+            // Output results
+            LOG("Found %li triangles in %3.2f ms\n",
+                TC.num_triangles, time_ms
+            );
+            // Keep the results of the last run
+            if (i == last_intersection && trial == args.num_trials - 1) { break; }
+            // Reset for next run
+            tc_data_clear();
+        }
+        mean_time_ms[i] = total_time_ms / args.num_trials;
+    }
+
+    if (args.per_vertex) {
+        LOG("Transitivity: %f\n", tc_transitivity());
+    }
+    if (per_vertex_fp) {
+        LOG("Writing per-vertex triangle counts to %s...\n", args.per_vertex_file);
+        tc_write_vertex_triangles(per_vertex_fp);
+        fclose(per_vertex_fp);
+    }
+
+    // Compare the strategies
+    if (first_intersection != last_intersection) {
+        LOG("Mean time per intersection strategy:\n");
+        for (long i = first_intersection; i <= last_intersection; ++i) {
+            LOG("\t%-10s %3.2f ms (%3.2fx merge)\n", intersection_names[i], mean_time_ms[i],
+                mean_time_ms[i] > 0 ? mean_time_ms[TC_INTERSECT_MERGE] / mean_time_ms[i] : 0.0);
         }
-        // Output results
-        LOG("Found %li triangles in %3.2f ms\n",
-            TC.num_triangles, time_ms
-        );
-        // Reset for next run
-        tc_data_clear();
     }
+    tc_deinit();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+
+/**
+ * Helpers for parsing text edge lists
+ * Pure C and header-only, so they can be shared by the graph loader and the
+ * C++ converters in the generator subdirectory.
+ *
+ * Supported formats:
+ *   el          : "src dst" on each line, separated by spaces or tabs
+ *   SNAP        : Same as el, with '#' comment lines
+ *   MatrixMarket: "%%MatrixMarket matrix coordinate ..." banner, '%' comment
+ *                 lines and a "rows cols entries" size line, then "row col [value]"
+ *                 on each line, with 1-based indices
+ * Anything after the second field on a line (weights, timestamps) is ignored.
+ *
+ * The input is meant to be parsed in parallel: split the data into chunks
+ * with text_edge_list_chunk_begin(), which moves each boundary to the start
+ * of a line, then call text_edge_list_next_edge() over each chunk. Callers
+ * usually do one pass to count the edges in each chunk and a second pass to
+ * write them out at the right offsets.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+typedef enum text_edge_list_format {
+    TEXT_EDGE_LIST_EL,
+    TEXT_EDGE_LIST_SNAP,
+    TEXT_EDGE_LIST_MATRIX_MARKET,
+} text_edge_list_format;
+
+typedef struct text_edge_list_info {
+    text_edge_list_format format;
+    // Offset of the first line of edges
+    size_t data_offset;
+    // Subtract this from each vertex ID (MatrixMarket indices start at 1)
+    long index_base;
+    // Number of vertices given by the file itself, or -1 if unknown
+    long num_vertices;
+} text_edge_list_info;
+
+static inline bool
+text_edge_list_is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+static inline bool
+text_edge_list_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Returns a pointer to the first character of the next line, or end
+static inline const char *
+text_edge_list_skip_line(const char * p, const char * end)
+{
+    const char * newline = (const char *)memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+// Parse an unsigned integer, advancing p past it. Returns false if there are no digits at p
+static inline bool
+text_edge_list_parse_long(const char ** p, const char * end, long * value)
+{
+    const char * s = *p;
+    if (s >= end || !text_edge_list_is_digit(*s)) { return false; }
+    long x = 0;
+    for (; s < end && text_edge_list_is_digit(*s); ++s) {
+        x = x * 10 + (*s - '0');
+    }
+    *value = x;
+    *p = s;
+    return true;
+}
+
+/**
+ * Find the next edge, starting from the beginning of a line
+ * Skips blank lines, comment lines and lines that don't start with two integers.
+ * @param p Current position, updated to the start of the next line
+ * @param end End of the chunk
+ * @param src, dst Output vertex ID's (index base not applied)
+ * @return false if there are no more edges in the chunk
+ */
+static inline bool
+text_edge_list_next_edge(const char ** p, const char * end, long * src, long * dst)
+{
+    const char * s = *p;
+    while (s < end) {
+        while (s < end && text_edge_list_is_space(*s)) { ++s; }
+        bool found = text_edge_list_parse_long(&s, end, src);
+        if (found) {
+            while (s < end && text_edge_list_is_space(*s)) { ++s; }
+            found = text_edge_list_parse_long(&s, end, dst);
+        }
+        s = text_edge_list_skip_line(s, end);
+        if (found) {
+            *p = s;
+            return true;
+        }
+    }
+    *p = end;
+    return false;
+}
+
+// Move an arbitrary position in the buffer forward to the start of a line
+// Every line belongs to exactly one chunk if all chunk boundaries are moved this way
+static inline size_t
+text_edge_list_chunk_begin(const char * buf, size_t len, size_t pos)
+{
+    if (pos == 0) { return 0; }
+    if (pos >= len) { return len; }
+    // If pos is already at the start of a line, keep it
+    if (buf[pos - 1] == '\n') { return pos; }
+    return text_edge_list_skip_line(buf + pos, buf + len) - buf;
+}
+
+// Detect the format of a text edge list, and find where the edges begin
+static inline text_edge_list_info
+text_edge_list_detect(const char * buf, size_t len)
+{
+    text_edge_list_info info;
+    info.format = TEXT_EDGE_LIST_EL;
+    info.data_offset = 0;
+    info.index_base = 0;
+    info.num_vertices = -1;
+
+    const char * end = buf + len;
+    const char * banner = "%%MatrixMarket";
+    size_t banner_len = strlen(banner);
+    if (len >= banner_len && !strncmp(buf, banner, banner_len)) {
+        info.format = TEXT_EDGE_LIST_MATRIX_MARKET;
+        info.index_base = 1;
+        // Skip banner and comments
+        const char * p = buf;
+        while (p < end && *p == '%') { p = text_edge_list_skip_line(p, end); }
+        // Parse size line
+        long rows = 0, cols = 0;
+        if (text_edge_list_next_edge(&p, end, &rows, &cols)) {
+            info.num_vertices = rows > cols ? rows : cols;
+        }
+        info.data_offset = p - buf;
+    } else if (len > 0 && buf[0] == '#') {
+        info.format = TEXT_EDGE_LIST_SNAP;
+    }
+    return info;
+}